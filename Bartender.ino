@@ -4,64 +4,172 @@
 #include "serial.h"
 #include "handler.h"
 #include "bartender.h"
-#include "timer.h"
 #include "queue.h"
+#include "pqueue.h"
 #include "error.h"
+#include "parser.h"
+#include "settings.h"
+#include "idle.h"
+#include "task.h"
 
 stepper_t stepper;
 handler_t handler;
 toggle_driver_t toggler;
 bartender_t bartender;
 
-// Data for the queue
-queue_t queue;
-uint8_t qdata[MSG_SIZE * 10];
+// Data for the queue of each priority class. Every queue has QUEUE_CAPACITY
+// slots. The limit is the most commands a class will hold.
+#define QUERY_LIMIT 4
+#define MAINTENANCE_LIMIT 2
+uint8_t query_data[MSG_SIZE * QUEUE_CAPACITY];
+uint8_t qdata[MSG_SIZE * QUEUE_CAPACITY];
+uint8_t maintenance_data[MSG_SIZE * QUEUE_CAPACITY];
 
-// Current buffers
+// The queues from the highest priority down
+queue_t queues[PRIORITY_CLASSES];
+pqueue_t pqueue;
+
+// Assembles messages from the serial bytes
+parser_t parser;
+
+// The message that is being received. It points straight into the next
+// queue slot or into the temp buffer when the queue is full.
+uint8_t *frame = 0;
+
+// Holds a message when the queue is full so that we can still answer it
 uint8_t temp_buffer[MSG_SIZE];
-uint8_t size = 0;
 
-void handle()
+// Runs the activities of the main loop
+scheduler_t scheduler;
+
+// Picks the buffer that the next message is assembled in
+static void receive_frame()
+{
+	// Between messages. Most messages are motion commands so write
+	// the next one right into that queue.
+	if (parser_idle(&parser))
+	{
+		frame = pqueue_reserve(&pqueue, PRIORITY_MOTION);
+
+		// Oh boy the queue is full
+		if (frame == 0)
+		{
+			frame = temp_buffer;
+		}
+	}
+}
+
+// Queues or rejects the message that the parser just finished
+static void receive_result(uint8_t result)
+{
+	// Either way the main loop has something to send
+	idle_notify();
+
+	// We lost sync somewhere. The parser holds on to the bytes after the
+	// bad message and replays them.
+	if (result == PARSER_ERROR)
+	{
+		handler_reject(&handler, BLANK, BLANK, RSP_MAL_MSG);
+		return;
+	}
+
+	// We have a message! I wonder who its from
+	// The link works so confirm any baud rate switch
+	handler_link_ok(&handler);
+
+	// Reject bad commands now instead of when they reach the front
+	// of the queue. The error will be sent by the handler.
+	if (handler_check(&handler, frame) != RSP_OK)
+	{
+		return;
+	}
+
+	uint8_t priority = handler_priority(frame[I_CMD]);
+	uint8_t code = E_NO_ERROR;
+
+	if (priority == PRIORITY_EMERGENCY)
+	{
+		// Oh boy. Clear the queue. This might get ugly
+		pqueue_clear(&pqueue, PRIORITY_MOTION);
+
+		// Stop right away. The slot is never committed so the next
+		// message reuses it.
+		handler_stop(&handler, frame);
+	}
+	else if (priority != PRIORITY_MOTION)
+	{
+		// Copy it over to the queue of its class. The motion slot
+		// is reused by the next message.
+		code = pqueue_enqueue(&pqueue, priority, frame);
+	}
+	else if (frame == temp_buffer)
+	{
+		code = E_BUFF_OVERFLOW;
+	}
+	else
+	{
+		// Add the message to the queue
+		pqueue_commit(&pqueue, PRIORITY_MOTION);
+	}
+
+	if (code != E_NO_ERROR)
+	{
+		// There was no room in the queue
+		handler_reject(&handler, frame[I_CMD], frame[I_SEQ], RSP_QUEUE_FULL);
+	}
+}
+
+// Called from the receive interrupt with every byte. A message is queued
+// the moment its last byte arrives. Nothing is written to the serial
+// connection here. The handler sends the responses from the main loop.
+void receive(uint8_t data)
+{
+	receive_frame();
+
+	uint8_t result = parser_feed(&parser, frame, data);
+
+	// A bad message may have held back more messages behind it
+	while (result != PARSER_MORE)
+	{
+		receive_result(result);
+
+		receive_frame();
+		result = parser_replay(&parser, frame);
+	}
+}
+
+// Sends the responses and events and finishes the command in progress. The
+// bartender adds its pour and reset sequences to the scheduler as tasks of
+// their own.
+uint8_t update_task(task_t *task)
 {
-	// While there is serial data available
-	while (serial_available() > 0)
+	handler_update(&handler);
+
+	return TASK_WAITING;
+}
+
+// Starts the queued commands that are allowed to go
+uint8_t dispatch_task(task_t *task)
+{
+	while (1)
 	{
-		// Copy the byte into our temp buffer
-		serial_read_byte(&temp_buffer[size]);
-		size++;
-		
-		// We have a message! I wonder who its from
-		if (size == MSG_SIZE)
+		// Queries can always go. The rest wait for the command in progress.
+		uint8_t lowest = handler_busy(&handler) ? PRIORITY_QUERY : PRIORITY_MAINTENANCE;
+
+		// Look at the next command of the highest class
+		uint8_t priority;
+		uint8_t *cmd = pqueue_peek(&pqueue, lowest, &priority);
+
+		if (cmd == 0)
 		{
-			// If it is the status or the stop command we need to process it right away
-			if (temp_buffer[I_CMD] == CMD_STATUS || temp_buffer[I_CMD] == CMD_STOP)
-			{
-				// Oh boy. Clear the queue. This might get ugly
-				if (temp_buffer[I_CMD] == CMD_STOP)
-				{
-					queue_clear(&queue);
-				}
-				
-				// Handle the command right away
-				handler_handle(&handler, temp_buffer);
-			}
-			else
-			{
-				// Add the buffer to the queue
-				uint8_t error = queue_enqueue(&queue, temp_buffer);
-				
-				// Oh boy the queue is full
-				if (error == E_BUFF_OVERFLOW)
-				{
-					uint8_t buffer[MSG_SIZE];
-					protocol_build_error_rsp(buffer, temp_buffer[I_CMD], RSP_QUEUE_FULL);
-					serial_write_chunk(buffer, MSG_SIZE);
-				}
-			}
-			
-			// Clear the buffer
-			size = 0;
+			return TASK_WAITING;
 		}
+
+		// Handle the next command in place and then free its slot. A STOP
+		// may have cleared the queue in the meantime so only the slot that
+		// was handled is freed.
+		handler_handle(&handler, cmd);
+		pqueue_release(&pqueue, priority, cmd);
 	}
 }
 
@@ -71,21 +179,54 @@ void setup()
 	serial_begin(9600);
 	
 	// Init stepper
-	stepper_init(&stepper, 2, 3, 4, 5);
-	stepper.delay = 3;
+	stepper_init(&stepper, STEPPER_FULL_STEP);
+	stepper.motion.start_delay = 3000;
+	stepper.motion.cruise_delay = 1000;
 	stepper_release(&stepper);
 	
 	// Init Toggler
-	toggle_driver_init(&toggler, 6, 7);
+	toggle_driver_init(&toggler);
 	
 	// Init bartender
-	bartender_init(&bartender, &stepper, &toggler, 0);
+	bartender_init(&bartender, &stepper, &toggler, &scheduler, 0);
 	
 	// Init message handler
 	handler_init(&handler, &bartender);
 	
-	// Init the queue
-	queue_init(&queue, qdata, MSG_SIZE, 10);
+	// Init the queues
+	queue_init(&queues[PRIORITY_QUERY], query_data, MSG_SIZE, QUERY_LIMIT);
+	queue_init(&queues[PRIORITY_MOTION], qdata, MSG_SIZE, QUEUE_CAPACITY);
+	queue_init(&queues[PRIORITY_MAINTENANCE], maintenance_data, MSG_SIZE, MAINTENANCE_LIMIT);
+	pqueue_init(&pqueue, queues, PRIORITY_CLASSES);
+	parser_init(&parser);
+
+	// Let the control device tune things without a reflash
+	settings_register(SETTING_START_DELAY, &stepper.motion.start_delay, SETTING_U16, 100, 20000);
+	settings_register(SETTING_CRUISE_DELAY, &stepper.motion.cruise_delay, SETTING_U16, 100, 20000);
+	settings_register(SETTING_ACCEL, &stepper.motion.accel, SETTING_U16, 1, 0xFFFF);
+	settings_register(SETTING_DECEL, &stepper.motion.decel, SETTING_U16, 1, 0xFFFF);
+	settings_register(SETTING_SHOT, &bartender.shot, SETTING_U8, 1, 255);
+	settings_register(SETTING_POUR_DOWN_TIME, &bartender.down_time, SETTING_U16, 0, 60000);
+	settings_register(SETTING_POUR_CLEARANCE, &bartender.clearance_time, SETTING_U16, 0, 60000);
+	settings_register(SETTING_QUEUE_LIMIT, &queues[PRIORITY_MOTION].limit, SETTING_U8, 1, QUEUE_CAPACITY);
+
+	// Home is always at 0
+	settings_register(SETTING_OFFSET(0), &bartender.offsets[0], SETTING_U16, 0, 0);
+
+	for (uint8_t i = 1; i < BARTENDER_LOCATIONS; i++)
+	{
+		settings_register(SETTING_OFFSET(i), &bartender.offsets[i], SETTING_U16, 0, 0x7FFF);
+	}
+
+	// Every dispenser has its own stroke and flow
+	for (uint8_t i = 0; i < BARTENDER_LOCATIONS; i++)
+	{
+		settings_register(SETTING_UP_TIME(i), &bartender.up_times[i], SETTING_U16, 0, 60000);
+		settings_register(SETTING_FLOW(i), &bartender.flows[i], SETTING_U16, 0, 1000);
+	}
+
+	// Use the saved settings if there are any
+	settings_load();
 	
 	// Pin Change Interrupt Control Register
 	// Page 73 of documentation
@@ -99,35 +240,31 @@ void setup()
 	EICRA |= ~(1 << ISC00) | (1 << ISC01);
 	pinMode(8, INPUT); 
 	
-	// Init the timer
-	timer2_init_ms(150, handle);
+	// Finish the command in progress before starting the next one
+	scheduler_init(&scheduler);
+	scheduler_add(&scheduler, update_task, 0);
+	scheduler_add(&scheduler, dispatch_task, 0);
+
+	// Sleep between passes of the main loop
+	idle_init();
+
+	// Assemble messages as the bytes arrive
+	serial_on_receive(receive);
 }
 
 void loop()
 {
-	// If we have commands to process
-	if (queue.size != 0)
-	{
-		// Declare temporary storage for the command
-		uint8_t cmd[MSG_SIZE];
-		
-		// Dequeue the next command in the queue
-		queue_dequeue(&queue, cmd);
-		
-		// Handle the next command
-		handler_handle(&handler, cmd);
-	}
-	
-	// Sleep little baby
-	delay(5);
+	// Sleep until an interrupt leaves us something to do
+	idle_wait();
+
+	// Give every task a turn
+	scheduler_run(&scheduler);
 }
 
 ISR(PCINT0_vect)
 {
-	if (bartender.status == STATUS_MOVING && bartender.location != 0)
-	{
-		bartender.status = STATUS_INT;
-	}
+	bartender_bump(&bartender);
+	idle_notify();
 	
 	PCIFR |= (1 << PCIF0);
 }
\ No newline at end of file
@@ -7,157 +7,899 @@
 #include <util/atomic.h>
 
 /**
- * Step distance array. Hardik can't measure.
+ * Step distance array (in full steps). Hardik can't measure.
  */
 uint16_t step_distances[13] = {880, 635, 675, 675, 660, 675, 675, 675, 675, 675, 645, 675, 675};
 
-void bartender_init(bartender_t *bartender, stepper_t *stepper, toggle_driver_t *toggler, uint8_t location)
+/**
+ * Calibration phases
+ */
+#define PHASE_CAL_HOME 0x02
+#define PHASE_CAL_OUT 0x03
+#define PHASE_CAL_BACK 0x04
+#define PHASE_CAL_BACKOFF 0x05
+
+#if !RING_VALID_CAPACITY(BARTENDER_EVENTS)
+#error "The number of bartender events must be a power of two no larger than 128"
+#endif
+
+static void bartender_event(bartender_t *bartender, uint8_t code);
+static void bartender_wait(bartender_t *bartender, unsigned long duration);
+static uint8_t bartender_waiting(bartender_t *bartender);
+static void bartender_home(bartender_t *bartender);
+static void bartender_move(bartender_t *bartender, uint8_t location);
+static uint8_t bartender_finish(bartender_t *bartender);
+static uint8_t bartender_calibrate_next(bartender_t *bartender);
+static void bartender_retract(bartender_t *bartender);
+static void bartender_pour_up(bartender_t *bartender);
+static uint8_t bartender_start(bartender_t *bartender, uint8_t (*run)(task_t *task));
+static uint8_t bartender_pour_task(task_t *task);
+static uint8_t bartender_reset_task(task_t *task);
+static uint8_t bartender_recipe_next(bartender_t *bartender);
+static uint16_t bartender_distance(bartender_t *bartender, uint8_t from, uint8_t to);
+static unsigned long bartender_recipe_travel(bartender_t *bartender);
+static void bartender_recipe_sort(recipe_step_t *steps, uint8_t count, uint8_t descending);
+static uint16_t bartender_recipe_reorder(bartender_t *bartender);
+
+/**
+ * Records an event. Every caller has interrupts disabled so the events
+ * can be recorded from the main loop and from the ISRs.
+ */
+static void bartender_event(bartender_t *bartender, uint8_t code)
+{
+	// Nobody has taken the old ones. Keep the order and drop this one.
+	if (ring_full(&bartender->event_ring, BARTENDER_EVENTS))
+	{
+		bartender->events_lost++;
+		return;
+	}
+
+	bartender_event_t *event = &bartender->events[ring_head(&bartender->event_ring, BARTENDER_EVENTS)];
+
+	event->code = code;
+	event->location = bartender->location;
+	event->position = bartender_position(bartender);
+	event->time = millis();
+
+	ring_push(&bartender->event_ring);
+}
+
+/**
+ * Starts timing a phase of the pour or reset sequence
+ */
+static void bartender_wait(bartender_t *bartender, unsigned long duration)
+{
+	bartender->started = millis();
+	bartender->duration = duration;
+}
+
+/**
+ * Sees if the current phase of the pour or reset sequence is still running
+ */
+static uint8_t bartender_waiting(bartender_t *bartender)
+{
+	return (millis() - bartender->started) < bartender->duration;
+}
+
+/**
+ * Stops the actuator once a down stroke that outlived its pour is done
+ */
+static void bartender_retract(bartender_t *bartender)
+{
+	if (bartender->retracting && (millis() - bartender->retract_started) >= bartender->down_time)
+	{
+		toggle_driver_stop(bartender->toggler);
+		bartender->retracting = 0;
+	}
+}
+
+/**
+ * Starts the up stroke of a pour
+ */
+static void bartender_pour_up(bartender_t *bartender)
+{
+	toggle_driver_move(bartender->toggler, UP);
+	bartender_wait(bartender, bartender->up_times[bartender->location]);
+
+	bartender_event(bartender, EVENT_POUR_STARTED);
+}
+
+/**
+ * Adds a sequence to the scheduler. It starts on the next pass of the main
+ * loop.
+ */
+static uint8_t bartender_start(bartender_t *bartender, uint8_t (*run)(task_t *task))
+{
+	if (scheduler_add(bartender->scheduler, run, bartender) == TASK_NONE)
+	{
+		return E_BUSY;
+	}
+
+	return E_NO_ERROR;
+}
+
+/**
+ * The pour sequence. Up. Hold. Down.
+ */
+static uint8_t bartender_pour_task(task_t *task)
+{
+	bartender_t *bartender = (bartender_t *) task->data;
+
+	// A stop ends the sequence where it is
+	if (bartender->status != STATUS_POURING)
+	{
+		task_init(task);
+		return TASK_EXITED;
+	}
+
+	TASK_BEGIN(task);
+
+	// Wait for the last pour to finish lowering the actuator
+	TASK_WAIT_UNTIL(task, !bartender->retracting);
+
+	bartender_pour_up(bartender);
+	TASK_WAIT_UNTIL(task, !bartender_waiting(bartender));
+
+	// Leave the actuator up while the liquid runs
+	toggle_driver_stop(bartender->toggler);
+	bartender_wait(bartender, bartender->hold);
+	TASK_WAIT_UNTIL(task, !bartender_waiting(bartender));
+
+	toggle_driver_move(bartender->toggler, DOWN);
+	bartender->retract_started = millis();
+
+	// The plate only has to wait for the glass to be clear
+	bartender_wait(bartender, min(bartender->clearance_time, bartender->down_time));
+	TASK_WAIT_UNTIL(task, !bartender_waiting(bartender));
+
+	// We are done but the actuator keeps lowering.
+	// bartender_update() stops it at the end of the stroke.
+	bartender->retracting = 1;
+	bartender_retract(bartender);
+
+	bartender->status = STATUS_NONE;
+
+	bartender_event(bartender, EVENT_POUR_DONE);
+
+	TASK_END(task);
+}
+
+/**
+ * The reset sequence. Lower the actuator and then home the plate.
+ */
+static uint8_t bartender_reset_task(task_t *task)
+{
+	bartender_t *bartender = (bartender_t *) task->data;
+
+	// A stop ends the sequence where it is
+	if (bartender->status != STATUS_RESETTING)
+	{
+		task_init(task);
+		return TASK_EXITED;
+	}
+
+	TASK_BEGIN(task);
+
+	// Lower the linear actuator for pouring
+	toggle_driver_move(bartender->toggler, DOWN);
+	bartender_wait(bartender, bartender->down_time);
+	TASK_WAIT_UNTIL(task, !bartender_waiting(bartender));
+
+	toggle_driver_stop(bartender->toggler);
+
+	// Move to location 0. The move finishes like any other move.
+	bartender_home(bartender);
+
+	TASK_END(task);
+}
+
+/**
+ * Crawls back towards location 0 until we hit the bump sensor
+ */
+static void bartender_home(bartender_t *bartender)
+{
+	bartender->target = 0;
+	bartender->direction = REVERSE;
+	bartender->status = STATUS_MOVING;
+
+	// We know how far it is so only the last bit is a crawl
+	stepper_start(bartender->stepper, 0xFFFF, bartender->position, REVERSE);
+}
+
+void bartender_init(bartender_t *bartender, stepper_t *stepper, toggle_driver_t *toggler, scheduler_t *scheduler, uint8_t location)
 {
 	bartender->stepper = stepper;
 	bartender->toggler = toggler;
+	bartender->scheduler = scheduler;
 	bartender->location = location;
+	bartender->target = location;
+
+	// Add up the distances once so a move is a subtraction
+	uint16_t offset = 0;
+
+	for (uint8_t i = 0; i < BARTENDER_LOCATIONS; i++)
+	{
+		bartender->offsets[i] = offset;
+		offset += step_distances[i];
+	}
+
+	bartender->position = bartender->offsets[location] * stepper->mode;
+	bartender->direction = FORWARD;
+	bartender->status = STATUS_NONE;
+
+	for (uint8_t i = 0; i < BARTENDER_LOCATIONS; i++)
+	{
+		bartender->up_times[i] = POUR_UP_TIME;
+		bartender->flows[i] = POUR_FLOW;
+	}
+
+	bartender->shot = POUR_SHOT;
+	bartender->down_time = POUR_DOWN_TIME;
+	bartender->clearance_time = POUR_CLEARANCE_TIME;
+	bartender->retracting = 0;
+	bartender->retract_started = 0;
+	bartender->phase = PHASE_CAL_HOME;
+	bartender->hold = 0;
+	bartender->started = 0;
+	bartender->duration = 0;
+
+	bartender->recipe_length = 0;
+	bartender->recipe_next = 0;
+	bartender->recipe_running = 0;
+
+	bartender->bumped = 0;
+	bartender->reference = 0;
+
+	ring_init(&bartender->event_ring);
+	bartender->events_lost = 0;
 }
 
 
-uint8_t bartender_move_to_location(bartender_t *bartender, uint8_t location)
+/**
+ * Starts the move to a location. Called with interrupts disabled.
+ */
+static void bartender_move(bartender_t *bartender, uint8_t location)
 {
-	// Make sure that we are not doing anything
-	if (bartender->status != STATUS_NONE)
+	// The offsets are in full steps
+	uint16_t target = bartender->offsets[location] * bartender->stepper->mode;
+
+	// Nowhere to go
+	if (bartender->position == target)
 	{
-		return E_BUSY;
+		bartender->location = location;
+		return;
+	}
+
+	uint8_t direction = FORWARD;
+	uint16_t total = target - bartender->position;
+
+	if (bartender->position > target)
+	{
+		direction = REVERSE;
+		total = bartender->position - target;
+	}
+
+	// Special case. Keep going until we hit the bump sensor
+	// Side note: I personally disagree with this case but the hardware guys
+	// demand I implement it. Hooray for relying on safety systems for normal
+	// operation
+	uint16_t steps = total;
+
+	if (location == 0)
+	{
+		steps = 0xFFFF;
 	}
 
 	// We are moving
+	bartender->target = location;
+	bartender->direction = direction;
 	bartender->status = STATUS_MOVING;
 
-	uint8_t direction = FORWARD;
+	// Hand the move to the stepper interrupt. The ramps are planned for
+	// the real distance so a homing move crawls into the bump sensor.
+	stepper_start(bartender->stepper, steps, total, direction);
+}
+
+uint8_t bartender_move_to_location(bartender_t *bartender, uint8_t location)
+{
+	uint8_t code = E_NO_ERROR;
 
-	if (bartender->location > location)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		direction = REVERSE;
+		// Make sure that we are not doing anything
+		if (bartender->status != STATUS_NONE)
+		{
+			code = E_BUSY;
+		}
+		else
+		{
+			bartender_move(bartender, location);
+		}
 	}
 
-	// While the location doesn't equal location
-	while (bartender->location != location)
+	return code;
+}
+
+/**
+ * Starts the actions of the recipe until one of them has to be waited on.
+ * Moves to where we already are and empty pours finish right away.
+ */
+static uint8_t bartender_recipe_next(bartender_t *bartender)
+{
+	while (bartender->recipe_next < (uint8_t) (bartender->recipe_length << 1))
 	{
-		uint16_t steps = 0;
+		recipe_step_t *step = &bartender->recipe[bartender->recipe_next >> 1];
 
-		// Get the number of steps to the new location
-		if (direction == FORWARD)
+		// Odd actions are the pours
+		if (bartender->recipe_next & 0x01)
 		{
-			steps = step_distances[bartender->location];
+			bartender_pour(bartender, step->shots & RECIPE_SHOTS);
 		}
 		else
 		{
-			steps = step_distances[bartender->location - 1];
+			bartender_move_to_location(bartender, step->location);
 		}
 
-		// Special case. Keep going until we hit the bump sensor
-		// Side note: I personally disagree with this case but the hardware guys
-		// demand I implement it. Hooray for relying on safety systems for normal
-		// operation
-		if (location == 0 && bartender->location == 1)
+		bartender->recipe_next++;
+
+		if (bartender->status != STATUS_NONE)
 		{
-			steps = 0xFFFF;
+			return E_BUSY;
 		}
+	}
+
+	// That was the last step
+	bartender->recipe_running = 0;
+	bartender->recipe_length = 0;
+	bartender->recipe_next = 0;
+
+	return E_NO_ERROR;
+}
+
+/**
+ * Starts the next phase of a calibration once the last move has stopped
+ */
+static uint8_t bartender_calibrate_next(bartender_t *bartender)
+{
+	// Homing and crawling back must end on the bump sensor
+	if ((bartender->phase == PHASE_CAL_HOME || bartender->phase == PHASE_CAL_BACK) && !bartender->bumped)
+	{
+		stepper_release(bartender->stepper);
+		bartender->status = STATUS_STOPPED;
+		return E_GENERAL;
+	}
+
+	bartender->bumped = 0;
+
+	switch (bartender->phase)
+	{
+	case PHASE_CAL_BACKOFF:
+		// Clear of the sensor so now find home
+		bartender->position += stepper_taken(bartender->stepper);
+		bartender->direction = REVERSE;
+		bartender->phase = PHASE_CAL_HOME;
+
+		stepper_start(bartender->stepper, 0xFFFF, bartender->position, REVERSE);
+		return E_BUSY;
+
+	case PHASE_CAL_HOME:
+		// Drive out to the last location like any other move
+		bartender->position = 0;
+		bartender->reference = bartender->offsets[BARTENDER_LOCATIONS - 1] * bartender->stepper->mode;
+		bartender->direction = FORWARD;
+		bartender->phase = PHASE_CAL_OUT;
+
+		stepper_start(bartender->stepper, bartender->reference, bartender->reference, FORWARD);
+		return E_BUSY;
+
+	case PHASE_CAL_OUT:
+		// Crawl back and count the steps
+		bartender->position = bartender->reference;
+		bartender->direction = REVERSE;
+		bartender->phase = PHASE_CAL_BACK;
+
+		stepper_start(bartender->stepper, 0xFFFF, 0, REVERSE);
+		return E_BUSY;
+
+	default:
+		break;
+	}
+
+	uint16_t measured = stepper_taken(bartender->stepper);
+
+	// Scale the table by how far we really went
+	for (uint8_t i = 0; i < BARTENDER_LOCATIONS; i++)
+	{
+		bartender->offsets[i] = (uint16_t) (((unsigned long) bartender->offsets[i] * measured + bartender->reference / 2) / bartender->reference);
+	}
+
+	stepper_release(bartender->stepper);
+
+	// We are home
+	bartender->position = 0;
+	bartender->location = 0;
+	bartender->status = STATUS_NONE;
+
+	bartender_event(bartender, EVENT_ARRIVED);
+
+	return E_NO_ERROR;
+}
 
-		// Now step baby step (as long as our status doesn't change)
-		for (uint16_t i = 0; (i < steps) && (bartender->status == STATUS_MOVING); i++)
+uint16_t bartender_position(bartender_t *bartender)
+{
+	uint16_t position;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		position = bartender->position;
+
+		// Only a move changes the position
+		if (bartender->status == STATUS_MOVING || bartender->status == STATUS_CALIBRATING)
 		{
-			stepper_step(bartender->stepper, direction);
+			uint16_t taken = stepper_taken(bartender->stepper);
+
+			if (bartender->direction == FORWARD)
+			{
+				position += taken;
+			}
+			else
+			{
+				// A homing move that missed the bump sensor can run past home
+				position = taken > position ? 0 : position - taken;
+			}
 		}
+	}
 
-		// We were interrupted
-		if (bartender->status == STATUS_INT)
+	return position;
+}
+
+uint8_t bartender_update(bartender_t *bartender)
+{
+	uint8_t code;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// The actuator may still be lowering from the last pour
+		bartender_retract(bartender);
+
+		code = bartender_finish(bartender);
+
+		// Keep going with the recipe
+		if (code == E_NO_ERROR && bartender->recipe_running)
 		{
-			stepper_release(bartender->stepper);
-			bartender->location = 0;
-			bartender->status = STATUS_NONE;
-			return E_NO_ERROR;
+			code = bartender_recipe_next(bartender);
 		}
+	}
+
+	return code;
+}
 
-		// Update the location variable
-		if (direction == FORWARD)
+/**
+ * Finishes the action that the bartender is performing once it has completed.
+ * bartender_update() calls this with interrupts disabled.
+ */
+static uint8_t bartender_finish(bartender_t *bartender)
+{
+	switch (bartender->status)
+	{
+	case STATUS_MOVING:
+		// Still on our way
+		if (stepper_running(bartender->stepper))
 		{
-			bartender->location++;
+			return E_BUSY;
 		}
-		else
+
+		// Release the stepper
+		stepper_release(bartender->stepper);
+
+		// We have arrived
+		bartender->position = bartender_position(bartender);
+		bartender->location = bartender->target;
+		bartender->status = STATUS_NONE;
+
+		bartender_event(bartender, EVENT_ARRIVED);
+		return E_NO_ERROR;
+
+	case STATUS_INT:
+		// We hit the bump sensor so we must be home
+		stepper_release(bartender->stepper);
+		bartender->position = 0;
+		bartender->location = 0;
+		bartender->status = STATUS_NONE;
+
+		bartender_event(bartender, EVENT_ARRIVED);
+		return E_NO_ERROR;
+
+	case STATUS_POURING:
+	case STATUS_RESETTING:
+		// The scheduler runs the sequence. A pour ends with STATUS_NONE and
+		// a reset with a move home that finishes like any other move.
+		return E_BUSY;
+
+	case STATUS_CALIBRATING:
+		// Still on our way
+		if (stepper_running(bartender->stepper))
 		{
-			bartender->location--;
+			return E_BUSY;
 		}
+
+		return bartender_calibrate_next(bartender);
+
+	case STATUS_STOPPED:
+		return E_INT;
+
+	default:
+		return E_NO_ERROR;
 	}
+}
 
-	// Release the stepper
-	stepper_release(bartender->stepper);
+void bartender_bump(bartender_t *bartender)
+{
+	// Only heading home can hit the bump sensor. Leaving home
+	// can still see the sensor bounce.
+	if (bartender->direction != REVERSE)
+	{
+		return;
+	}
 
-	// We are done
-	bartender->status = STATUS_NONE;
+	if (bartender->status == STATUS_MOVING)
+	{
+		stepper_halt(bartender->stepper);
+		bartender_event(bartender, EVENT_BUMP);
+		bartender->status = STATUS_INT;
+	}
+	else if (bartender->status == STATUS_CALIBRATING)
+	{
+		// bartender_update() needs to know we really hit it
+		stepper_halt(bartender->stepper);
+		bartender_event(bartender, EVENT_BUMP);
+		bartender->bumped = 1;
+	}
+}
+
+uint8_t bartender_next_event(bartender_t *bartender, bartender_event_t *event_out)
+{
+	// Only the main loop takes events so the tail is ours
+	if (ring_empty(&bartender->event_ring))
+	{
+		return E_EMPTY;
+	}
+
+	*event_out = bartender->events[ring_tail(&bartender->event_ring, BARTENDER_EVENTS)];
+	ring_pop(&bartender->event_ring);
 
 	return E_NO_ERROR;
 }
 
 uint8_t bartender_pour(bartender_t *bartender, uint8_t amount)
 {
-	// Make sure that we are not doing anything
-	if (bartender->status != STATUS_NONE)
+	return bartender_pour_ml(bartender, (uint16_t) amount * bartender->shot);
+}
+
+uint8_t bartender_pour_ml(bartender_t *bartender, uint16_t ml)
+{
+	uint8_t code = E_NO_ERROR;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		return E_BUSY;
+		// Make sure that we are not doing anything
+		if (bartender->status != STATUS_NONE)
+		{
+			code = E_BUSY;
+		}
+		// Nothing to pour
+		else if (ml != 0)
+		{
+			// One long hold instead of a stroke per shot. A large volume holds
+			// for longer than 16 bits of milliseconds.
+			bartender->hold = (unsigned long) ml * bartender->flows[bartender->location];
+
+			// We are pouring
+			bartender->status = STATUS_POURING;
+
+			// The pour sequence does the rest
+			if (bartender_start(bartender, bartender_pour_task) != E_NO_ERROR)
+			{
+				bartender->status = STATUS_NONE;
+				code = E_BUSY;
+			}
+		}
 	}
 
-	// We are pouring
-	bartender->status = STATUS_POURING;
+	return code;
+}
 
-	// Up. Delay. Down. Delay.
-	for (uint8_t i = 0; i < amount; i++)
+uint8_t bartender_stop(bartender_t *bartender)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		toggle_driver_move(bartender->toggler, UP);
-		delay(5000);
+		// Stop the plate and the pour where they are
+		stepper_halt(bartender->stepper);
+		toggle_driver_stop(bartender->toggler);
+		bartender->retracting = 0;
 
-		toggle_driver_move(bartender->toggler, DOWN);
-		delay(5000);
+		// Remember where on the rail we stopped
+		bartender->position = bartender_position(bartender);
 
-		toggle_driver_stop(bartender->toggler);
-	}
+		// Let other functions know we are stopped
+		bartender->status = STATUS_STOPPED;
 
-	// We are done
-	bartender->status = STATUS_NONE;
+		// The rest of the recipe will not be made
+		bartender->recipe_running = 0;
+		bartender->recipe_length = 0;
+		bartender->recipe_next = 0;
+
+		bartender_event(bartender, EVENT_STOPPED);
+	}
 
 	return E_NO_ERROR;
 }
 
-uint8_t bartender_stop(bartender_t *bartender)
+uint8_t bartender_reset(bartender_t *bartender)
 {
-	// Let other functions know we are stopped
-	bartender->status = STATUS_STOPPED;
+	uint8_t code = E_NO_ERROR;
 
-	return E_NO_ERROR;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Make sure that we are in the stopped state
+		if (bartender->status != STATUS_STOPPED)
+		{
+			code = E_INV_CALL;
+		}
+		else
+		{
+			// We are resetting
+			bartender->status = STATUS_RESETTING;
+
+			// Lower the linear actuator for pouring. The reset sequence homes
+			// the plate once it is down.
+			if (bartender_start(bartender, bartender_reset_task) != E_NO_ERROR)
+			{
+				bartender->status = STATUS_STOPPED;
+				code = E_BUSY;
+			}
+		}
+	}
+
+	return code;
 }
 
-uint8_t bartender_reset(bartender_t *bartender)
+uint8_t bartender_calibrate(bartender_t *bartender)
 {
-	// Make sure that we are in the stopped state
-	if (bartender->status != STATUS_STOPPED)
+	uint8_t code = E_NO_ERROR;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		return E_INV_CALL;
+		// Make sure that we are not doing anything
+		if (bartender->status != STATUS_NONE || bartender->recipe_running)
+		{
+			code = E_BUSY;
+		}
+		// The measurement is scaled by the offset of the last location
+		else if (bartender->offsets[BARTENDER_LOCATIONS - 1] == 0)
+		{
+			code = E_INV_CALL;
+		}
+		else
+		{
+			bartender->bumped = 0;
+			bartender->target = 0;
+			bartender->status = STATUS_CALIBRATING;
+
+			uint16_t backoff = CALIBRATE_BACKOFF * bartender->stepper->mode;
+
+			if (bartender->position < backoff)
+			{
+				// We may be sitting on the bump sensor. Homing would never see
+				// it pressed so back away first.
+				bartender->direction = FORWARD;
+				bartender->phase = PHASE_CAL_BACKOFF;
+
+				stepper_start(bartender->stepper, backoff - bartender->position, backoff - bartender->position, FORWARD);
+			}
+			else
+			{
+				// Find home first. bartender_update() does the rest.
+				bartender->direction = REVERSE;
+				bartender->phase = PHASE_CAL_HOME;
+
+				stepper_start(bartender->stepper, 0xFFFF, bartender->position, REVERSE);
+			}
+		}
 	}
 
-	// Lower the linear actuator for pouring
-	toggle_driver_move(bartender->toggler, DOWN);
-	delay(5000);
+	return code;
+}
 
-	toggle_driver_stop(bartender->toggler);
+uint8_t bartender_recipe_add(bartender_t *bartender, const uint8_t *steps, uint8_t count)
+{
+	uint8_t code = E_NO_ERROR;
 
-	// Move to location 0
-	while (bartender->status != STATUS_INT)
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		stepper_step(bartender->stepper, REVERSE);
+		// Can't change a recipe we are making
+		if (bartender->recipe_running)
+		{
+			code = E_BUSY;
+		}
+		// Too long. Start over.
+		else if (count > RECIPE_MAX_STEPS - bartender->recipe_length)
+		{
+			bartender->recipe_length = 0;
+			code = E_BUFF_OVERFLOW;
+		}
+		else
+		{
+			for (uint8_t i = 0; i < count; i++)
+			{
+				recipe_step_t *step = &bartender->recipe[bartender->recipe_length++];
+
+				step->location = steps[i << 1];
+				step->shots = steps[(i << 1) + 1];
+			}
+		}
 	}
 
-	// Reset the location
-	bartender->location = 0;
+	return code;
+}
 
-	// Reset the status
-	bartender->status = STATUS_NONE;
+uint8_t bartender_recipe_start(bartender_t *bartender)
+{
+	uint8_t code = E_NO_ERROR;
 
-	return E_NO_ERROR;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Make sure that we are not doing anything
+		if (bartender->status != STATUS_NONE || bartender->recipe_running)
+		{
+			code = E_BUSY;
+		}
+		else
+		{
+			bartender->recipe_running = 1;
+			bartender->recipe_next = 0;
+
+			// Start the first step. bartender_update() does the rest.
+			bartender_recipe_next(bartender);
+		}
+	}
+
+	return code;
+}
+
+void bartender_recipe_clear(bartender_t *bartender)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (!bartender->recipe_running)
+		{
+			bartender->recipe_length = 0;
+		}
+	}
+}
+
+/**
+ * Gets the distance between two locations (in full steps)
+ */
+static uint16_t bartender_distance(bartender_t *bartender, uint8_t from, uint8_t to)
+{
+	uint16_t a = bartender->offsets[from];
+	uint16_t b = bartender->offsets[to];
+
+	return a > b ? a - b : b - a;
+}
+
+/**
+ * Adds up the travel of the recipe from the current location (in full steps)
+ */
+static unsigned long bartender_recipe_travel(bartender_t *bartender)
+{
+	unsigned long total = 0;
+	uint8_t at = bartender->location;
+
+	for (uint8_t i = 0; i < bartender->recipe_length; i++)
+	{
+		total += bartender_distance(bartender, at, bartender->recipe[i].location);
+		at = bartender->recipe[i].location;
+	}
+
+	return total;
+}
+
+/**
+ * Sorts steps by location. Insertion sort since there are never many steps
+ * and it keeps steps at the same location together.
+ */
+static void bartender_recipe_sort(recipe_step_t *steps, uint8_t count, uint8_t descending)
+{
+	for (uint8_t i = 1; i < count; i++)
+	{
+		recipe_step_t step = steps[i];
+		uint8_t j = i;
+
+		while (j > 0 && (descending ? steps[j - 1].location < step.location : steps[j - 1].location > step.location))
+		{
+			steps[j] = steps[j - 1];
+			j--;
+		}
+
+		steps[j] = step;
+	}
+}
+
+/**
+ * Sorts the runs of unordered steps so that the plate sweeps across them and
+ * returns how far the plate travels less. Called with interrupts disabled.
+ */
+static uint16_t bartender_recipe_reorder(bartender_t *bartender)
+{
+	unsigned long before = bartender_recipe_travel(bartender);
+
+	uint8_t at = bartender->location;
+	uint8_t first = 0;
+
+	while (first < bartender->recipe_length)
+	{
+		// Ordered steps stay put
+		if (bartender->recipe[first].shots & RECIPE_ORDERED)
+		{
+			at = bartender->recipe[first].location;
+			first++;
+			continue;
+		}
+
+		// Find the end of the group and the ends of the rail it covers
+		uint8_t end = first;
+		uint8_t low = 0xFF;
+		uint8_t high = 0;
+
+		while (end < bartender->recipe_length && !(bartender->recipe[end].shots & RECIPE_ORDERED))
+		{
+			low = min(low, bartender->recipe[end].location);
+			high = max(high, bartender->recipe[end].location);
+			end++;
+		}
+
+		// Sweep up or sweep down. Count the trip to the next ordered step too.
+		unsigned long up = bartender_distance(bartender, at, low);
+		unsigned long down = bartender_distance(bartender, at, high);
+
+		if (end < bartender->recipe_length)
+		{
+			up += bartender_distance(bartender, high, bartender->recipe[end].location);
+			down += bartender_distance(bartender, low, bartender->recipe[end].location);
+		}
+
+		uint8_t descending = down < up;
+
+		bartender_recipe_sort(&bartender->recipe[first], end - first, descending);
+
+		at = descending ? low : high;
+		first = end;
+	}
+
+	unsigned long after = bartender_recipe_travel(bartender);
+
+	if (after >= before)
+	{
+		return 0;
+	}
+
+	return (uint16_t) min(before - after, 0xFFFFUL);
+}
+
+uint16_t bartender_recipe_optimize(bartender_t *bartender)
+{
+	uint16_t saved = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Too late to change anything
+		if (!bartender->recipe_running)
+		{
+			saved = bartender_recipe_reorder(bartender);
+		}
+	}
+
+	return saved;
 }
@@ -26,6 +26,8 @@ extern "C"
 #include "inttypes.h"
 #include "stepper.h"
 #include "toggle_driver.h"
+#include "ring.h"
+#include "task.h"
 
 // --------------------------------------------------------------------
 // Status Definitions
@@ -58,6 +60,142 @@ extern "C"
  */
 #define STATUS_STOPPED 0x04
 
+/**
+ * The bartender is lowering the pouring actuator and homing the drink plate
+ * after being stopped.
+ */
+#define STATUS_RESETTING 0x05
+
+/**
+ * The bartender is measuring the rail with the bump sensor.
+ */
+#define STATUS_CALIBRATING 0x06
+
+// --------------------------------------------------------------------
+// Event Definitions
+// --------------------------------------------------------------------
+
+/**
+ * The drink plate has reached the location it was moving to. The event codes
+ * are sent to the control device as they are (see EVT_ARRIVED in protocol.h).
+ */
+#define EVENT_ARRIVED 0x01
+
+/**
+ * The pouring actuator has started its up stroke.
+ */
+#define EVENT_POUR_STARTED 0x02
+
+/**
+ * A pour has finished and the glass is clear of the actuator.
+ */
+#define EVENT_POUR_DONE 0x03
+
+/**
+ * The bartender has been stopped.
+ */
+#define EVENT_STOPPED 0x04
+
+/**
+ * The bump sensor has stopped the drink plate.
+ */
+#define EVENT_BUMP 0x05
+
+/**
+ * The number of events that can wait to be sent. Must be a power of two.
+ */
+#define BARTENDER_EVENTS 8
+
+/**
+ * Something that happened to the bartender. Events are recorded as they happen
+ * so the time and the position are where the bartender was right then.
+ */
+typedef struct
+{
+	uint8_t code; /**< what happened as defined by the event definitions found in this file */
+	uint8_t location; /**< the location of the bartender */
+	uint16_t position; /**< the number of steps from home to the drink plate */
+	unsigned long time; /**< when it happened (in milliseconds) */
+} bartender_event_t;
+
+// --------------------------------------------------------------------
+// Pour Definitions
+// --------------------------------------------------------------------
+
+/**
+ * The default time it takes to raise the pouring actuator (in milliseconds)
+ */
+#define POUR_UP_TIME 5000
+
+/**
+ * The default time the actuator is held up for each milliliter poured
+ * (in milliseconds)
+ */
+#define POUR_FLOW 50
+
+/**
+ * The default size of a shot (in milliliters)
+ */
+#define POUR_SHOT 44
+
+/**
+ * The default time it takes to lower the pouring actuator (in milliseconds)
+ */
+#define POUR_DOWN_TIME 5000
+
+/**
+ * The default time into the last down stroke of a pour after which the
+ * actuator is clear of the glass and the plate may move (in milliseconds).
+ * Set it to the down time to wait for the whole stroke.
+ */
+#define POUR_CLEARANCE_TIME 2000
+
+// --------------------------------------------------------------------
+// Location Definitions
+// --------------------------------------------------------------------
+
+/**
+ * The number of locations on the rail. Location 0 is home.
+ */
+#define BARTENDER_LOCATIONS 13
+
+/**
+ * How far a calibration backs away from home before homing (in full steps).
+ * Homing stops on the press of the bump sensor so the plate can't already be
+ * on it.
+ */
+#define CALIBRATE_BACKOFF 200
+
+// --------------------------------------------------------------------
+// Recipe Definitions
+// --------------------------------------------------------------------
+
+/**
+ * The most steps that a recipe can have
+ */
+#define RECIPE_MAX_STEPS 26
+
+/**
+ * Set in the shots of a step that must be made in the order it was given.
+ * Every other step may be reordered to cut down on travel.
+ */
+#define RECIPE_ORDERED 0x80
+
+/**
+ * The bits of the shots of a step that hold the number of shots
+ */
+#define RECIPE_SHOTS 0x7F
+
+/**
+ * One step of a recipe. The drink plate is moved to the location and then
+ * the shots are poured.
+ */
+typedef struct
+{
+	uint8_t location; /**< the location the step is poured at */
+	uint8_t shots; /**< the number of shots to pour and the RECIPE_ORDERED flag */
+} recipe_step_t;
+
 /**
  * The structure of a bartender. Hold all the attributes that a bartender
  * has. Please look at the file explanation for more documentation.
@@ -69,8 +207,41 @@ typedef struct
 	toggle_driver_t *toggler; /**< the motor driver of the vertical linear actuator
 	 	 	 	 	 	 	 	 that dispenses liquid */
 	uint8_t location; /**< the current location of the drink plate of the bartender */
+	uint16_t position; /**< the number of steps from home to the drink plate. While
+	 	 	 	 	 	 moving this is where the move started. */
+	uint16_t offsets[BARTENDER_LOCATIONS]; /**< the distance from home to each location
+	 	 	 	 	 	 	 	 	 	 	 (in full steps) */
+	uint8_t target; /**< the location the drink plate is moving to */
+	uint8_t direction; /**< the direction the drink plate is moving in */
 	volatile uint8_t status; /**< the status of the bartender as defined by the status
 	 	 	 	 	 	 definitions found in this file. */
+	uint16_t up_times[BARTENDER_LOCATIONS]; /**< the time it takes to raise the pouring
+	 	 	 	 	 	 	 	 	 	 	 actuator at each location (in milliseconds) */
+	uint16_t flows[BARTENDER_LOCATIONS]; /**< the time the actuator is held up for each
+	 	 	 	 	 	 	 	 	 	 milliliter at each location (in milliseconds) */
+	uint8_t shot; /**< the size of a shot (in milliliters) */
+	uint16_t down_time; /**< the time it takes to lower the pouring actuator (in milliseconds) */
+	uint16_t clearance_time; /**< the time into the last down stroke after which the
+	 	 	 	 	 	 	 	 plate may move (in milliseconds) */
+	uint8_t retracting; /**< true while the actuator finishes a down stroke after
+	 	 	 	 	 	 the pour has completed */
+	unsigned long retract_started; /**< the time the last down stroke started (in milliseconds) */
+	uint8_t phase; /**< the phase of the calibration */
+	unsigned long hold; /**< the time the actuator is held up for the pour (in milliseconds) */
+	unsigned long started; /**< the time the current wait started (in milliseconds) */
+	unsigned long duration; /**< the length of the current wait (in milliseconds) */
+	scheduler_t *scheduler; /**< runs the pour and reset sequences */
+	recipe_step_t recipe[RECIPE_MAX_STEPS]; /**< the steps of the recipe */
+	uint8_t recipe_length; /**< the number of steps in the recipe */
+	uint8_t recipe_next; /**< the next action of a running recipe. Every step is
+	 	 	 	 	 	 a move followed by a pour so step i is actions 2i and 2i + 1 */
+	uint8_t recipe_running; /**< true while a recipe is being run */
+	volatile uint8_t bumped; /**< set when the bump sensor stops a calibration move */
+	uint16_t reference; /**< the number of steps driven out from home during a calibration */
+	bartender_event_t events[BARTENDER_EVENTS]; /**< the events that have not been sent yet */
+	ring_t event_ring; /**< the head and the tail of the events */
+	uint16_t events_lost; /**< the number of events that were thrown away because
+	 	 	 	 	 	 	 the events were full */
 } bartender_t;
 
 /**
@@ -86,10 +257,11 @@ typedef struct
  * @param [in] stepper the stepper that drives the horizontal linear
  * actuator of the bartender
  * @param [in] toggler the vertical linear actuator that dispenses liquid
+ * @param [in] scheduler the scheduler that runs the pour and reset sequences
  * @param [in] location the starting location of the bartender
  *
  */
-void bartender_init(bartender_t *bartender, stepper_t *stepper, toggle_driver_t *toggler, uint8_t location);
+void bartender_init(bartender_t *bartender, stepper_t *stepper, toggle_driver_t *toggler, scheduler_t *scheduler, uint8_t location);
 
 /**
  * @name    Bartender Move to Location
@@ -100,6 +272,12 @@ void bartender_init(bartender_t *bartender, stepper_t *stepper, toggle_driver_t
  * vertical linear actuator to the location that is passed into this
  * function. Each drink dispenser has a location label starting at
  * 1 and ending at 12. 0 is the magic value for the home location.
+ * The move is a single run of steps from the current step position to
+ * the offset of the location so it works from anywhere on the rail.
+ *
+ * @note This function only starts the move. The plate is stepped by the
+ * stepper interrupt and bartender_update() must be called until it no longer
+ * returns E_BUSY.
  *
  * @warning This function returns E_BUSY if the status of the bartender
  * is not STATUS_NONE.
@@ -115,13 +293,88 @@ void bartender_init(bartender_t *bartender, stepper_t *stepper, toggle_driver_t
  */
 uint8_t bartender_move_to_location(bartender_t *bartender, uint8_t location);
 
+/**
+ * @name    Bartender Position
+ * @brief   Gets the step position of the drink plate
+ * @ingroup bartender
+ *
+ * While the plate is moving the steps that the stepper has taken are added
+ * to the position that the move started from.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ *
+ * @returns the number of steps from home to the drink plate
+ */
+uint16_t bartender_position(bartender_t *bartender);
+
+/**
+ * @name    Bartender Update
+ * @brief   Checks on the action that the bartender is performing
+ * @ingroup bartender
+ *
+ * This function finishes an action once it has completed. When a move has
+ * completed the location of the bartender is updated and the status is set
+ * back to STATUS_NONE. The phases of a calibration are started here and the
+ * actuator is stopped once a down stroke that outlived its pour is done. The
+ * strokes of a pour and the phases of a reset are not timed here. They are
+ * run by tasks that bartender_pour_ml() and bartender_reset() add to the
+ * scheduler. While a pour or a reset is running this function returns E_BUSY.
+ * While a recipe is running the next step is started as soon as the last one
+ * completes so the whole recipe looks like one action. This function should
+ * be called from the main loop while an action is in progress.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ *
+ * @retval E_NO_ERROR the bartender is not performing an action or the action
+ * has just completed
+ * @retval E_BUSY the action is still in progress
+ * @retval E_INT the bartender has been stopped
+ * @retval E_GENERAL a calibration did not find the bump sensor
+ */
+uint8_t bartender_update(bartender_t *bartender);
+
+/**
+ * @name    Bartender Bump
+ * @brief   Lets the bartender know that the bump sensor has been hit
+ * @ingroup bartender
+ *
+ * If the drink plate is heading home the stepper is halted right away and
+ * the status is set to STATUS_INT. The next call to bartender_update() will
+ * then set the location to home. A calibration that is heading home is
+ * halted the same way but keeps its status.
+ *
+ * @note This function is meant to be called from the bump sensor ISR.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ */
+void bartender_bump(bartender_t *bartender);
+
+/**
+ * @name    Bartender Next Event
+ * @brief   Takes the oldest event that has not been sent
+ * @ingroup bartender
+ *
+ * The bartender records an event when the plate reaches a location, a pour
+ * starts or finishes, the bartender is stopped and the bump sensor is hit.
+ * Events may be recorded from an ISR. If the events fill up before they are
+ * taken the newest ones are thrown away and counted in events_lost.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ * @param [out] event_out where the event will be copied to
+ *
+ * @retval E_NO_ERROR an event was copied to event_out
+ * @retval E_EMPTY there are no events
+ */
+uint8_t bartender_next_event(bartender_t *bartender, bartender_event_t *event_out);
+
 /**
  * @name    Bartender Pour
  * @brief   Pours an amount of liquid from the current location
  * @ingroup bartender
  *
  * The bartender will pour the specified amount from the dispenser
- * that the bartender is currently at.
+ * that the bartender is currently at. This is the same as calling
+ * bartender_pour_ml() with the amount times the size of a shot.
  *
  * @warning This function returns E_BUSY if the status of the bartender
  * is not STATUS_NONE.
@@ -137,6 +390,36 @@ uint8_t bartender_move_to_location(bartender_t *bartender, uint8_t location);
  */
 uint8_t bartender_pour(bartender_t *bartender, uint8_t amount);
 
+/**
+ * @name    Bartender Pour Milliliters
+ * @brief   Pours a volume of liquid from the current location
+ * @ingroup bartender
+ *
+ * The actuator is raised once, held up for the volume times the flow of
+ * the location and then lowered. The up stroke time and the flow are looked
+ * up for the location the bartender is at.
+ *
+ * @note This function only adds the pour task to the scheduler. The task
+ * times the up stroke, the hold and the down stroke with millis() on the
+ * following passes of the main loop. The pour completes clearance_time into
+ * the down stroke so that the next move can start while the actuator keeps
+ * lowering. bartender_update() stops the actuator at the end of the stroke.
+ * If the actuator is still lowering from the last pour the task waits for it
+ * to finish.
+ *
+ * @warning This function returns E_BUSY if the status of the bartender
+ * is not STATUS_NONE.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ * @param [in] ml the volume to pour (in milliliters)
+ *
+ * @retval E_NO_ERROR no error occurred and the function was completed
+ * successfully
+ * @retval E_BUSY if the status of the bartender was not STATUS_NONE before
+ * the function was called or the scheduler has no free slot for the pour task
+ */
+uint8_t bartender_pour_ml(bartender_t *bartender, uint16_t ml);
+
 /**
  * @name    Bartender Stop
  * @brief   Stops any operation of the bartender
@@ -146,7 +429,9 @@ uint8_t bartender_pour(bartender_t *bartender, uint8_t amount);
  *
  * @note That this stops the bartender in the current state. (If the
  * bartender was moving or if the bartender was pouring this function
- * will stop any operation in the current state).
+ * will stop any operation in the current state). A pour is cut in the
+ * middle of its stroke and the rest of a recipe is thrown away. This
+ * function is safe to call from an ISR.
  *
  * @param [in] bartender The bartender that is being operated on
  *
@@ -166,6 +451,10 @@ uint8_t bartender_stop(bartender_t *bartender);
  * and the location of the bartender. This function must be called in order
  * for the bartender to process commands after the stop function is called.
  *
+ * @note This function only adds the reset task to the scheduler. The task
+ * lowers the actuator for down_time and then starts the move home. That move
+ * is finished by bartender_update() like any other move.
+ *
  * @warning This function returns E_INV_CALL if the status of the bartender
  * is not STATUS_STOPPED.
  *
@@ -174,9 +463,118 @@ uint8_t bartender_stop(bartender_t *bartender);
  * @retval E_NO_ERROR no error occurred and the function was completed
  * successfully
  * @retval E_INV_CALL if the status of the bartender is not STATUS_STOPPED
+ * @retval E_BUSY if the scheduler has no free slot for the reset task
  */
 uint8_t bartender_reset(bartender_t *bartender);
 
+/**
+ * @name    Bartender Calibrate
+ * @brief   Measures the rail and rescales the location offsets
+ * @ingroup bartender
+ *
+ * The plate is homed on the bump sensor and then driven out to the offset of
+ * the last location with the normal motion profile. If the plate is within
+ * CALIBRATE_BACKOFF steps of home it first moves that far away so that the
+ * sensor is pressed again on the way home. It then crawls back until
+ * it hits the bump sensor again while the steps are counted. Crawling does not
+ * lose steps so the count is how far the plate really went. Every offset is
+ * scaled by the measured distance over the commanded distance.
+ *
+ * There is only one sensor on the rail so the locations can not be measured
+ * one at a time. The whole table is scaled by the same amount.
+ *
+ * @note This function only starts homing. A calibration is not a scheduler
+ * task. Each phase is a move and bartender_update() starts the next phase
+ * once the last move has stopped. If a homing or crawl back move ends without
+ * the bump sensor being hit the bartender is stopped and bartender_update()
+ * returns E_GENERAL.
+ *
+ * @warning This function returns E_BUSY if the status of the bartender
+ * is not STATUS_NONE.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ *
+ * @retval E_NO_ERROR no error occurred and the calibration was started
+ * @retval E_BUSY if the status of the bartender was not STATUS_NONE before
+ * the function was called
+ * @retval E_INV_CALL if the offset of the last location is 0 so there is
+ * nothing to scale by
+ */
+uint8_t bartender_calibrate(bartender_t *bartender);
+
+/**
+ * @name    Bartender Recipe Add
+ * @brief   Adds steps to the recipe
+ * @ingroup bartender
+ *
+ * Appends steps to the end of the recipe that bartender_recipe_start() runs.
+ * The steps are packed as a location byte followed by a shots byte which is
+ * the layout of the content of the recipe commands.
+ *
+ * @warning This function returns E_BUSY if a recipe is running. If the steps
+ * do not fit the whole recipe is thrown away and E_BUFF_OVERFLOW is returned.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ * @param [in] steps the location and shots of each step
+ * @param [in] count the number of steps
+ *
+ * @retval E_NO_ERROR no error occurred and the steps were added
+ * @retval E_BUSY a recipe is running
+ * @retval E_BUFF_OVERFLOW the recipe would have more than RECIPE_MAX_STEPS steps
+ */
+uint8_t bartender_recipe_add(bartender_t *bartender, const uint8_t *steps, uint8_t count);
+
+/**
+ * @name    Bartender Recipe Optimize
+ * @brief   Reorders the recipe to cut down on travel
+ * @ingroup bartender
+ *
+ * Steps flagged with RECIPE_ORDERED stay where they are and split the recipe
+ * into groups. The steps of each group are sorted into a single sweep along
+ * the rail. The sweep starts at whichever end of the group is cheaper given
+ * where the plate comes from and where it has to go next. Distances come from
+ * the step distance table and the plate starts from the current location.
+ *
+ * @note This function does nothing to a running recipe.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ *
+ * @returns the number of full steps of travel that were saved
+ */
+uint16_t bartender_recipe_optimize(bartender_t *bartender);
+
+/**
+ * @name    Bartender Recipe Start
+ * @brief   Starts running the recipe
+ * @ingroup bartender
+ *
+ * Starts the first step of the recipe. bartender_update() starts the rest of
+ * the steps and returns E_NO_ERROR once after the last one. The recipe is
+ * emptied when it completes.
+ *
+ * @warning This function returns E_BUSY if the status of the bartender
+ * is not STATUS_NONE.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ *
+ * @retval E_NO_ERROR no error occurred and the recipe was started
+ * @retval E_BUSY if the status of the bartender was not STATUS_NONE before
+ * the function was called
+ */
+uint8_t bartender_recipe_start(bartender_t *bartender);
+
+/**
+ * @name    Bartender Recipe Clear
+ * @brief   Throws away the recipe
+ * @ingroup bartender
+ *
+ * Empties a recipe that has not been started. A running recipe is not
+ * touched. Use bartender_stop() to stop one.
+ *
+ * @param [in] bartender The bartender that is being operated on
+ */
+void bartender_recipe_clear(bartender_t *bartender);
+
 #ifdef __cplusplus
 }
 #endif
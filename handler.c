@@ -3,155 +3,735 @@
 #include "handler.h"
 #include "protocol.h"
 #include "serial.h"
+#include "error.h"
+#include "settings.h"
+#include "idle.h"
 
-static void handler_process_cmd_stop(handler_t *handler, uint8_t *buffer, uint8_t *rsp);
-static void handler_process_cmd_move(handler_t *handler, uint8_t *buffer, uint8_t *rsp);
-static void handler_process_cmd_pour(handler_t *handler, uint8_t *buffer, uint8_t *rsp);
-static void handler_process_cmd_status(handler_t *handler, uint8_t *buffer, uint8_t *rsp);
-static void handler_process_cmd_location(handler_t *handler, uint8_t *buffer, uint8_t *rsp);
-static void handler_process_unknown_cmd(handler_t *handler, uint8_t *buffer, uint8_t *rsp);
+#include <util/atomic.h>
+
+// The bartender's event codes go out as they are
+#if EVENT_ARRIVED != EVT_ARRIVED || EVENT_POUR_STARTED != EVT_POUR_STARTED || EVENT_POUR_DONE != EVT_POUR_DONE || \
+	EVENT_STOPPED != EVT_STOPPED || EVENT_BUMP != EVT_BUMP
+#error "The bartender event codes must match the protocol event codes"
+#endif
+
+#if !RING_VALID_CAPACITY(HANDLER_REJECTS)
+#error "The number of handler rejects must be a power of two no larger than 128"
+#endif
+
+static void handler_process_cmd_stop(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_move(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_pour(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_pour_ml(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_status(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_location(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_reset(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_baud(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_recipe(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_recipe_add(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_calibrate(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_get_param(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_set_param(handler_t *handler, uint8_t *buffer);
+static void handler_process_cmd_stats(handler_t *handler, uint8_t *buffer);
+static void handler_update_link(handler_t *handler);
+static void handler_send_events(handler_t *handler);
+static void handler_send_rejects(handler_t *handler);
 
 void handler_init(handler_t *handler, bartender_t *bartender)
 {
 	handler->bartender = bartender;
+	handler->active = BLANK;
+	handler->seq = BLANK;
+	handler->link = LINK_IDLE;
+	handler->link_seq = BLANK;
+	handler->link_baud = 0;
+	handler->link_prev = 0;
+	handler->link_started = 0;
+	handler->stop_pending = 0;
+	handler->stop_seq = BLANK;
+
+	ring_init(&handler->reject_ring);
+	handler->rejects_lost = 0;
 }
 
-void handler_handle(handler_t *handler, uint8_t *cmd)
+void handler_reject(handler_t *handler, uint8_t cmd, uint8_t seq, uint8_t code)
 {
-	uint8_t rsp[MSG_SIZE];
+	// The receive interrupt and the main loop both reject commands
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (ring_full(&handler->reject_ring, HANDLER_REJECTS))
+		{
+			handler->rejects_lost++;
+			return;
+		}
 
-	// Make sure we have a valid packet
-	if (cmd[I_START] != MSG_START || cmd[I_END] != MSG_END)
+		handler_reject_t *reject = &handler->rejects[ring_head(&handler->reject_ring, HANDLER_REJECTS)];
+
+		reject->cmd = cmd;
+		reject->seq = seq;
+		reject->code = code;
+
+		ring_push(&handler->reject_ring);
+	}
+}
+
+void handler_stop(handler_t *handler, uint8_t *cmd)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		// Send back a malformed packet error
-		protocol_build_error_rsp(rsp, BLANK, RSP_MAL_MSG);
-		serial_write_chunk(rsp, MSG_SIZE);
-		return;
+		// Stop whatever we are doing right now
+		bartender_stop(handler->bartender);
+
+		// handler_update() sends the ok
+		handler->stop_seq = cmd[I_SEQ];
+		handler->stop_pending = 1;
 	}
+}
+
+uint8_t handler_check(handler_t *handler, uint8_t *cmd)
+{
+	uint8_t code = RSP_OK;
 
-	// See if the type is command
-	if (cmd[I_TYPE] == TYPE_CMD)
+	// Make sure we have a valid packet
+	if (cmd[I_START] != MSG_START || cmd[I_LEN] > MSG_MAX_PAYLOAD || cmd[I_END(cmd[I_LEN])] != MSG_END)
+	{
+		code = RSP_MAL_MSG;
+	}
+	// Responses are not something we handle
+	else if (cmd[I_TYPE] == TYPE_RSP)
 	{
-		// Find the function to handle the command
-		switch(cmd[I_CMD])
+		code = RSP_NOT_IMPL;
+	}
+	else if (cmd[I_TYPE] != TYPE_CMD)
+	{
+		code = RSP_UNK_TYPE;
+	}
+	// We don't know the command
+	else if (protocol_payload_size(cmd[I_CMD]) == PAYLOAD_UNKNOWN)
+	{
+		code = RSP_UNK_CMD;
+	}
+	// The content is the wrong length for the command
+	else if (protocol_payload_size(cmd[I_CMD]) != PAYLOAD_VARIABLE && protocol_payload_size(cmd[I_CMD]) != cmd[I_LEN])
+	{
+		code = RSP_MAL_MSG;
+	}
+	else
+	{
+		switch (cmd[I_CMD])
 		{
-		case CMD_STOP:
-			handler_process_cmd_stop(handler, cmd, rsp);
-			break;
 		case CMD_MOVE:
-			handler_process_cmd_move(handler, cmd, rsp);
+			// Make sure the location is in range
+			if (cmd[PARAM_MOVE_LOC] > 12)
+			{
+				// Let them know we are not happy
+				handler_reject(handler, CMD_MOVE, cmd[I_SEQ], RSP_ERROR);
+				return RSP_ERROR;
+			}
 			break;
-		case CMD_POUR:
-			handler_process_cmd_pour(handler, cmd, rsp);
+		case CMD_RECIPE:
+		case CMD_RECIPE_ADD:
+			// The content must be whole steps
+			if (cmd[I_LEN] == 0 || (cmd[I_LEN] % LEN_RECIPE_STEP) != 0)
+			{
+				code = RSP_MAL_MSG;
+				break;
+			}
+
+			// Make sure every location is in range
+			for (uint8_t i = 0; i < cmd[I_LEN] / LEN_RECIPE_STEP; i++)
+			{
+				if (cmd[PARAM_RECIPE_LOC(i)] > 12)
+				{
+					handler_reject(handler, cmd[I_CMD], cmd[I_SEQ], RSP_ERROR);
+					return RSP_ERROR;
+				}
+			}
 			break;
-		case CMD_STATUS:
-			handler_process_cmd_status(handler, cmd, rsp);
+		case CMD_BAUD:
+			// Make sure we know the rate
+			if (protocol_baud_rate(cmd[PARAM_BAUD_RATE]) == 0)
+			{
+				handler_reject(handler, CMD_BAUD, cmd[I_SEQ], RSP_ERROR);
+				return RSP_ERROR;
+			}
 			break;
-		case CMD_LOCATION:
-			handler_process_cmd_location(handler, cmd, rsp);
+		}
+	}
+
+	if (code != RSP_OK)
+	{
+		// Send back the error
+		handler_reject(handler, BLANK, cmd[I_SEQ], code);
+	}
+
+	return code;
+}
+
+void handler_handle(handler_t *handler, uint8_t *cmd)
+{
+	// Make sure we have a valid command
+	if (handler_check(handler, cmd) != RSP_OK)
+	{
+		return;
+	}
+
+	// Find the function to handle the command
+	switch(cmd[I_CMD])
+	{
+	case CMD_STOP:
+		handler_process_cmd_stop(handler, cmd);
+		break;
+	case CMD_MOVE:
+		handler_process_cmd_move(handler, cmd);
+		break;
+	case CMD_POUR:
+		handler_process_cmd_pour(handler, cmd);
+		break;
+	case CMD_POUR_ML:
+		handler_process_cmd_pour_ml(handler, cmd);
+		break;
+	case CMD_STATUS:
+		handler_process_cmd_status(handler, cmd);
+		break;
+	case CMD_LOCATION:
+		handler_process_cmd_location(handler, cmd);
+		break;
+	case CMD_RESET:
+		handler_process_cmd_reset(handler, cmd);
+		break;
+	case CMD_BAUD:
+		handler_process_cmd_baud(handler, cmd);
+		break;
+	case CMD_RECIPE:
+		handler_process_cmd_recipe(handler, cmd);
+		break;
+	case CMD_RECIPE_ADD:
+		handler_process_cmd_recipe_add(handler, cmd);
+		break;
+	case CMD_CALIBRATE:
+		handler_process_cmd_calibrate(handler, cmd);
+		break;
+	case CMD_GET_PARAM:
+		handler_process_cmd_get_param(handler, cmd);
+		break;
+	case CMD_SET_PARAM:
+		handler_process_cmd_set_param(handler, cmd);
+		break;
+	case CMD_STATS:
+		handler_process_cmd_stats(handler, cmd);
+		break;
+	}
+}
+
+/**
+ * Carries out the baud rate switch. This runs from the main loop because
+ * the tx interrupt has to drain the buffer before the switch.
+ */
+static void handler_update_link(handler_t *handler)
+{
+	switch (handler->link)
+	{
+	case LINK_SWITCH:
+		// Let the ok response go out at the old rate. Check again on the
+		// next pass instead of blocking everything else.
+		if (!serial_idle())
+		{
 			break;
-		default:
-			handler_process_unknown_cmd(handler, cmd, rsp);
+		}
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			serial_begin(handler->link_baud);
+			handler->link_started = millis();
+			handler->link = LINK_CONFIRM;
+		}
+		break;
+
+	case LINK_CONFIRM:
+		// Still waiting to hear from the control device
+		if (millis() - handler->link_started < BAUD_TIMEOUT)
+		{
 			break;
 		}
+
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+		{
+			// A message may have arrived while we were checking
+			if (handler->link == LINK_CONFIRM)
+			{
+				// Nobody is listening at the new rate so go back
+				serial_begin(handler->link_prev);
+				handler->link = LINK_IDLE;
+
+				protocol_send_error_rsp(CMD_BAUD, handler->link_seq, RSP_ERROR);
+			}
+		}
+		break;
+
+	case LINK_CONFIRMED:
+		// The switch worked
+		protocol_send_complete_rsp(CMD_BAUD, handler->link_seq);
+
+		handler->link = LINK_IDLE;
+		break;
 	}
-	else if (cmd[I_TYPE] == TYPE_RSP)
+}
+
+/**
+ * Sends the responses that were put off by the receive interrupt
+ */
+static void handler_send_rejects(handler_t *handler)
+{
+	// Only the main loop takes rejects so the tail is ours
+	while (!ring_empty(&handler->reject_ring))
 	{
-		// Send back a not implemented type error
-		protocol_build_error_rsp(rsp, BLANK, RSP_NOT_IMPL);
-		serial_write_chunk(rsp, MSG_SIZE);
+		handler_reject_t *reject = &handler->rejects[ring_tail(&handler->reject_ring, HANDLER_REJECTS)];
+
+		protocol_send_error_rsp(reject->cmd, reject->seq, reject->code);
+
+		ring_pop(&handler->reject_ring);
 	}
-	else
+
+	uint8_t seq = BLANK;
+	uint8_t stopped = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		stopped = handler->stop_pending;
+		seq = handler->stop_seq;
+		handler->stop_pending = 0;
+	}
+
+	if (stopped)
+	{
+		protocol_send_ok_rsp(CMD_STOP, seq);
+	}
+}
+
+/**
+ * Sends every event that the bartender has recorded. This runs before the
+ * complete response so the control device sees the event first. The events
+ * carry the sequence id of the command in progress or BLANK if there is none.
+ */
+static void handler_send_events(handler_t *handler)
+{
+	serial_frame_t frame;
+	bartender_event_t event;
+
+	while (bartender_next_event(handler->bartender, &event) == E_NO_ERROR)
 	{
-		// Send back an unknown type error
-		protocol_build_error_rsp(rsp, BLANK, RSP_UNK_TYPE);
-		serial_write_chunk(rsp, MSG_SIZE);
+		if (protocol_build_event(&frame, event.code, handler->seq) != E_NO_ERROR)
+		{
+			continue;
+		}
+
+		serial_frame_put(&frame, EVT_TIME, (uint8_t) event.time);
+		serial_frame_put(&frame, EVT_TIME + 1, (uint8_t) (event.time >> 8));
+		serial_frame_put(&frame, EVT_TIME + 2, (uint8_t) (event.time >> 16));
+		serial_frame_put(&frame, EVT_TIME + 3, (uint8_t) (event.time >> 24));
+		serial_frame_put(&frame, EVT_POSITION, (uint8_t) event.position);
+		serial_frame_put(&frame, EVT_POSITION + 1, (uint8_t) (event.position >> 8));
+		serial_frame_put(&frame, EVT_LOCATION, event.location);
+
+		serial_commit(&frame);
 	}
 }
 
-static void handler_process_cmd_stop(handler_t *handler, uint8_t *buffer, uint8_t *rsp)
+void handler_link_ok(handler_t *handler)
 {
-	protocol_build_ok_rsp(rsp, CMD_STOP);
+	if (handler->link == LINK_CONFIRM)
+	{
+		handler->link = LINK_CONFIRMED;
+	}
 }
 
-static void handler_process_cmd_move(handler_t *handler, uint8_t *buffer, uint8_t *rsp)
+void handler_update(handler_t *handler)
 {
-	//Grab the variables from the content
-	uint8_t location = buffer[PARAM_MOVE_LOC];
+	serial_frame_t frame;
+
+	handler_send_rejects(handler);
+	handler_update_link(handler);
 
-	// Make sure the location is in range
-	if (location > 12)
+	// The bartender may have work to finish even when no command is
+	// waiting on it (like lowering the actuator after a pour)
+	uint8_t code = bartender_update(handler->bartender);
+
+	// Let the control device know what happened
+	handler_send_events(handler);
+
+	// Nothing to wait on
+	if (handler->active == BLANK)
+	{
+		return;
+	}
+
+	// Still working on it
+	if (code == E_BUSY)
 	{
-		// Let them know we are not happy
-		protocol_build_error_rsp(rsp, CMD_MOVE, RSP_ERROR);
-		serial_write_chunk(rsp, MSG_SIZE);
 		return;
 	}
 
+	if (code == E_NO_ERROR && handler->active == CMD_CALIBRATE)
+	{
+		// Send back the new table
+		if (protocol_build_rsp(&frame, CMD_CALIBRATE, handler->seq, RSP_COMPLETE, LEN_RES_CALIBRATE) == E_NO_ERROR)
+		{
+			// Home is always at 0 so it is left out
+			for (uint8_t i = 1; i < BARTENDER_LOCATIONS; i++)
+			{
+				serial_frame_put(&frame, RES_CALIBRATE_OFFSET(i), (uint8_t) handler->bartender->offsets[i]);
+				serial_frame_put(&frame, RES_CALIBRATE_OFFSET(i) + 1, (uint8_t) (handler->bartender->offsets[i] >> 8));
+			}
+
+			serial_commit(&frame);
+		}
+
+		// Keep the new table for the next boot
+		settings_save();
+	}
+	else if (code == E_NO_ERROR)
+	{
+		// We have processed the command
+		protocol_send_complete_rsp(handler->active, handler->seq);
+	}
+	else
+	{
+		// TODO better error code
+		protocol_send_error_rsp(handler->active, handler->seq, RSP_ERROR);
+	}
+
+	handler->active = BLANK;
+	handler->seq = BLANK;
+}
+
+uint8_t handler_priority(uint8_t cmd)
+{
+	switch (cmd)
+	{
+	case CMD_STOP:
+		return PRIORITY_EMERGENCY;
+	case CMD_STATUS:
+	case CMD_LOCATION:
+	case CMD_GET_PARAM:
+	case CMD_STATS:
+	case CMD_BAUD:
+		return PRIORITY_QUERY;
+	case CMD_CALIBRATE:
+	case CMD_SET_PARAM:
+		return PRIORITY_MAINTENANCE;
+	default:
+		return PRIORITY_MOTION;
+	}
+}
+
+uint8_t handler_busy(handler_t *handler)
+{
+	return handler->active != BLANK;
+}
+
+static void handler_process_cmd_stop(handler_t *handler, uint8_t *buffer)
+{
+	handler_stop(handler, buffer);
+}
+
+static void handler_process_cmd_move(handler_t *handler, uint8_t *buffer)
+{
+	//Grab the variables from the content
+	uint8_t location = buffer[PARAM_MOVE_LOC];
+
 	// We are processing the command
-	protocol_build_ok_rsp(rsp, CMD_MOVE);
-	serial_write_chunk(rsp, MSG_SIZE);
+	protocol_send_ok_rsp(CMD_MOVE, buffer[I_SEQ]);
 
 	// Start moving
 	uint8_t code = bartender_move_to_location(handler->bartender, location);
 
 	if (code == E_NO_ERROR)
 	{
-		// We have processed the command
-		protocol_build_complete_rsp(rsp, CMD_MOVE);
-		serial_write_chunk(rsp, MSG_SIZE);
+		// handler_update() will let them know when we get there
+		handler->active = CMD_MOVE;
+		handler->seq = buffer[I_SEQ];
 	}
 	else
 	{
 		// TODO better error code
-		protocol_build_error_rsp(rsp, CMD_MOVE, RSP_ERROR);
-		serial_write_chunk(rsp, MSG_SIZE);
+		protocol_send_error_rsp(CMD_MOVE, buffer[I_SEQ], RSP_ERROR);
 	}
 }
 
-static void handler_process_cmd_pour(handler_t *handler, uint8_t *buffer, uint8_t *rsp)
+static void handler_process_cmd_pour(handler_t *handler, uint8_t *buffer)
 {
 	// We have received the command
-	protocol_build_ok_rsp(rsp, CMD_POUR);
-	serial_write_chunk(rsp, MSG_SIZE);
+	protocol_send_ok_rsp(CMD_POUR, buffer[I_SEQ]);
 
 	uint8_t amount = buffer[PARAM_POUR_AMOUNT];
 
+	// Start pouring
 	uint8_t code = bartender_pour(handler->bartender, amount);
 
 	if (code == E_NO_ERROR)
 	{
-		// The command has been completed
-		protocol_build_complete_rsp(rsp, CMD_POUR);
-		serial_write_chunk(rsp, MSG_SIZE);
+		// handler_update() will let them know when the glass is full
+		handler->active = CMD_POUR;
+		handler->seq = buffer[I_SEQ];
 	}
 	else
 	{
 		//TODO better error codes
-		protocol_build_error_rsp(rsp, CMD_MOVE, RSP_ERROR);
-		serial_write_chunk(rsp, MSG_SIZE);
+		protocol_send_error_rsp(CMD_POUR, buffer[I_SEQ], RSP_ERROR);
+	}
+}
+
+static void handler_process_cmd_pour_ml(handler_t *handler, uint8_t *buffer)
+{
+	// We have received the command
+	protocol_send_ok_rsp(CMD_POUR_ML, buffer[I_SEQ]);
+
+	uint16_t ml = buffer[PARAM_POUR_ML] | ((uint16_t) buffer[PARAM_POUR_ML + 1] << 8);
+
+	// Start pouring
+	uint8_t code = bartender_pour_ml(handler->bartender, ml);
+
+	if (code == E_NO_ERROR)
+	{
+		// handler_update() will let them know when the glass is full
+		handler->active = CMD_POUR_ML;
+		handler->seq = buffer[I_SEQ];
+	}
+	else
+	{
+		protocol_send_error_rsp(CMD_POUR_ML, buffer[I_SEQ], RSP_ERROR);
 	}
 }
 
-static void handler_process_cmd_status(handler_t *handler, uint8_t *buffer, uint8_t *rsp)
+static void handler_process_cmd_status(handler_t *handler, uint8_t *buffer)
 {
-	// Build a response
-	protocol_build_ok_rsp(rsp, CMD_STATUS);
+	serial_frame_t frame;
+
+	// Build a response in the tx queue
+	if (protocol_build_rsp(&frame, CMD_STATUS, buffer[I_SEQ], RSP_OK, LEN_RES_STATUS) != E_NO_ERROR)
+	{
+		// No room so it was dropped
+		return;
+	}
 
 	// Put in the bartender's current status
-	rsp[RES_STATUS_STATUS] = handler->bartender->status;
+	serial_frame_put(&frame, RES_STATUS_STATUS, handler->bartender->status);
 
 	// Write the command back
-	serial_write_chunk(rsp, MSG_SIZE);
+	serial_commit(&frame);
+}
+
+static void handler_process_cmd_location(handler_t *handler, uint8_t *buffer)
+{
+	serial_frame_t frame;
+
+	// Build a response in the tx queue
+	if (protocol_build_rsp(&frame, CMD_LOCATION, buffer[I_SEQ], RSP_OK, LEN_RES_LOCATION) != E_NO_ERROR)
+	{
+		// No room so it was dropped
+		return;
+	}
+
+	// Put in the bartender's current location
+	serial_frame_put(&frame, RES_LOCATION_LOCATION, handler->bartender->location);
+
+	// Write the command back
+	serial_commit(&frame);
+}
+
+static void handler_process_cmd_reset(handler_t *handler, uint8_t *buffer)
+{
+	// We have received the command
+	protocol_send_ok_rsp(CMD_RESET, buffer[I_SEQ]);
+
+	// Start lowering the actuator and homing the plate
+	uint8_t code = bartender_reset(handler->bartender);
+
+	if (code == E_NO_ERROR)
+	{
+		// handler_update() will let them know when we are home
+		handler->active = CMD_RESET;
+		handler->seq = buffer[I_SEQ];
+	}
+	else
+	{
+		// We were not stopped
+		protocol_send_error_rsp(CMD_RESET, buffer[I_SEQ], RSP_ERROR);
+	}
+}
+
+static void handler_process_cmd_baud(handler_t *handler, uint8_t *buffer)
+{
+	unsigned long baud = protocol_baud_rate(buffer[PARAM_BAUD_RATE]);
+
+	// Only one switch at a time and the clock must be able to make the rate
+	if (handler->link != LINK_IDLE || serial_baud_error(baud) > BAUD_MAX_ERROR)
+	{
+		protocol_send_error_rsp(CMD_BAUD, buffer[I_SEQ], RSP_ERROR);
+		return;
+	}
+
+	// We will switch once this has been sent
+	protocol_send_ok_rsp(CMD_BAUD, buffer[I_SEQ]);
+
+	// handler_update() does the switch
+	handler->link_baud = baud;
+	handler->link_prev = serial_baud();
+	handler->link_seq = buffer[I_SEQ];
+	handler->link = LINK_SWITCH;
+}
+
+static void handler_process_cmd_recipe(handler_t *handler, uint8_t *buffer)
+{
+	serial_frame_t frame;
+
+	// Add the last steps and start making the drink
+	uint8_t code = bartender_recipe_add(handler->bartender, &buffer[I_PAYLOAD], buffer[I_LEN] / LEN_RECIPE_STEP);
+
+	uint16_t saved = 0;
+
+	if (code == E_NO_ERROR)
+	{
+		// Cut down on the back and forth before we start
+		saved = bartender_recipe_optimize(handler->bartender);
+		code = bartender_recipe_start(handler->bartender);
+	}
+
+	if (code == E_NO_ERROR)
+	{
+		if (protocol_build_rsp(&frame, CMD_RECIPE, buffer[I_SEQ], RSP_OK, LEN_RES_RECIPE) == E_NO_ERROR)
+		{
+			// Let them know how much travel we saved
+			serial_frame_put(&frame, RES_RECIPE_SAVED, (uint8_t) saved);
+			serial_frame_put(&frame, RES_RECIPE_SAVED + 1, (uint8_t) (saved >> 8));
+
+			serial_commit(&frame);
+		}
+
+		// handler_update() will let them know when the last step is done
+		handler->active = CMD_RECIPE;
+		handler->seq = buffer[I_SEQ];
+	}
+	else
+	{
+		// Don't let these steps end up in the next recipe
+		bartender_recipe_clear(handler->bartender);
+
+		protocol_send_error_rsp(CMD_RECIPE, buffer[I_SEQ], RSP_ERROR);
+	}
 }
 
-static void handler_process_cmd_location(handler_t *handler, uint8_t *buffer, uint8_t *rsp)
+static void handler_process_cmd_recipe_add(handler_t *handler, uint8_t *buffer)
 {
-	protocol_build_ok_rsp(rsp, CMD_LOCATION);
+	// Hold on to the steps until the recipe command
+	uint8_t code = bartender_recipe_add(handler->bartender, &buffer[I_PAYLOAD], buffer[I_LEN] / LEN_RECIPE_STEP);
+
+	if (code == E_NO_ERROR)
+	{
+		protocol_send_ok_rsp(CMD_RECIPE_ADD, buffer[I_SEQ]);
+	}
+	else
+	{
+		protocol_send_error_rsp(CMD_RECIPE_ADD, buffer[I_SEQ], RSP_ERROR);
+	}
 }
 
-static void handler_process_unknown_cmd(handler_t *handler, uint8_t *buffer, uint8_t *rsp)
+static void handler_process_cmd_calibrate(handler_t *handler, uint8_t *buffer)
 {
-	protocol_build_error_rsp(rsp, BLANK, RSP_UNK_CMD);
+	// We have received the command
+	protocol_send_ok_rsp(CMD_CALIBRATE, buffer[I_SEQ]);
+
+	// Start homing
+	uint8_t code = bartender_calibrate(handler->bartender);
+
+	if (code == E_NO_ERROR)
+	{
+		// handler_update() will send the new table when we are done
+		handler->active = CMD_CALIBRATE;
+		handler->seq = buffer[I_SEQ];
+	}
+	else
+	{
+		protocol_send_error_rsp(CMD_CALIBRATE, buffer[I_SEQ], RSP_ERROR);
+	}
 }
 
+static void handler_process_cmd_get_param(handler_t *handler, uint8_t *buffer)
+{
+	serial_frame_t frame;
+	uint16_t value;
+
+	if (settings_get(buffer[PARAM_SETTING_ID], &value) != E_NO_ERROR)
+	{
+		// We don't have that setting
+		protocol_send_error_rsp(CMD_GET_PARAM, buffer[I_SEQ], RSP_ERROR);
+		return;
+	}
+
+	// Build a response in the tx queue
+	if (protocol_build_rsp(&frame, CMD_GET_PARAM, buffer[I_SEQ], RSP_OK, LEN_RES_PARAM) != E_NO_ERROR)
+	{
+		// No room so it was dropped
+		return;
+	}
+
+	// Put in the value
+	serial_frame_put(&frame, RES_PARAM_VALUE, (uint8_t) value);
+	serial_frame_put(&frame, RES_PARAM_VALUE + 1, (uint8_t) (value >> 8));
+
+	serial_commit(&frame);
+}
+
+static void handler_process_cmd_set_param(handler_t *handler, uint8_t *buffer)
+{
+	uint16_t value = buffer[PARAM_SETTING_VALUE] | ((uint16_t) buffer[PARAM_SETTING_VALUE + 1] << 8);
+
+	if (settings_set(buffer[PARAM_SETTING_ID], value) != E_NO_ERROR)
+	{
+		// Unknown setting or out of range
+		protocol_send_error_rsp(CMD_SET_PARAM, buffer[I_SEQ], RSP_ERROR);
+		return;
+	}
+
+	// Keep it for the next boot
+	settings_save();
+
+	protocol_send_ok_rsp(CMD_SET_PARAM, buffer[I_SEQ]);
+}
+
+static void handler_process_cmd_stats(handler_t *handler, uint8_t *buffer)
+{
+	serial_frame_t frame;
+
+	// Build a response in the tx queue
+	if (protocol_build_rsp(&frame, CMD_STATS, buffer[I_SEQ], RSP_OK, LEN_RES_STATS) != E_NO_ERROR)
+	{
+		// No room so it was dropped
+		return;
+	}
+
+	// Put in the counters of the main loop
+	for (uint8_t i = 0; i < 4; i++)
+	{
+		serial_frame_put(&frame, RES_STATS_WAKES + i, (uint8_t) (idle_stats.wakes >> (i << 3)));
+		serial_frame_put(&frame, RES_STATS_WORK_WAKES + i, (uint8_t) (idle_stats.work_wakes >> (i << 3)));
+	}
+
+	serial_frame_put(&frame, RES_STATS_LATENCY, (uint8_t) idle_stats.latency);
+	serial_frame_put(&frame, RES_STATS_LATENCY + 1, (uint8_t) (idle_stats.latency >> 8));
+	serial_frame_put(&frame, RES_STATS_LATENCY_MAX, (uint8_t) idle_stats.latency_max);
+	serial_frame_put(&frame, RES_STATS_LATENCY_MAX + 1, (uint8_t) (idle_stats.latency_max >> 8));
+
+	// Put in the frames that were held up or lost
+	serial_frame_put(&frame, RES_STATS_TX_DELAYED, (uint8_t) serial_stats.delayed);
+	serial_frame_put(&frame, RES_STATS_TX_DELAYED + 1, (uint8_t) (serial_stats.delayed >> 8));
+	serial_frame_put(&frame, RES_STATS_TX_DROPPED, (uint8_t) serial_stats.dropped);
+	serial_frame_put(&frame, RES_STATS_TX_DROPPED + 1, (uint8_t) (serial_stats.dropped >> 8));
+	serial_frame_put(&frame, RES_STATS_EVENTS_LOST, (uint8_t) handler->bartender->events_lost);
+	serial_frame_put(&frame, RES_STATS_EVENTS_LOST + 1, (uint8_t) (handler->bartender->events_lost >> 8));
+	serial_frame_put(&frame, RES_STATS_REJECTS_LOST, (uint8_t) handler->rejects_lost);
+	serial_frame_put(&frame, RES_STATS_REJECTS_LOST + 1, (uint8_t) (handler->rejects_lost >> 8));
+
+	serial_commit(&frame);
+}
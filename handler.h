@@ -25,13 +25,95 @@ extern "C"
 #include "stepper.h"
 #include "bartender.h"
 #include "inttypes.h"
+#include "ring.h"
 
 /**
- *
+ * No baud rate switch is in progress
+ */
+#define LINK_IDLE 0x00
+
+/**
+ * The baud rate switch has been accepted and is waiting for the ok response
+ * to be sent
+ */
+#define LINK_SWITCH 0x01
+
+/**
+ * The baud rate has been switched and we are waiting for a valid message
+ */
+#define LINK_CONFIRM 0x02
+
+/**
+ * A valid message has been received at the new baud rate
+ */
+#define LINK_CONFIRMED 0x03
+
+/**
+ * Emergency commands (CMD_STOP). They are never queued. They are handled the
+ * moment they arrive and throw away every queued motion and maintenance command.
+ */
+#define PRIORITY_EMERGENCY 0xFF
+
+/**
+ * Queries and link control (CMD_STATUS, CMD_LOCATION, CMD_GET_PARAM,
+ * CMD_STATS and CMD_BAUD). They are served ahead of everything else, even while a command
+ * is in progress, since they don't use the bartender.
+ */
+#define PRIORITY_QUERY 0x00
+
+/**
+ * Drink plate and pour commands (CMD_MOVE, CMD_POUR, CMD_POUR_ML, CMD_RECIPE,
+ * CMD_RECIPE_ADD and CMD_RESET). One is run at a time.
+ */
+#define PRIORITY_MOTION 0x01
+
+/**
+ * Maintenance (CMD_CALIBRATE and CMD_SET_PARAM). They are run once there are
+ * no motion commands left.
+ */
+#define PRIORITY_MAINTENANCE 0x02
+
+/**
+ * The number of priority classes that are queued
+ */
+#define PRIORITY_CLASSES 3
+
+/**
+ * The number of error responses that can wait to be sent. Must be a power of two.
+ */
+#define HANDLER_REJECTS 4
+
+/**
+ * An error response that has not been sent yet
  */
 typedef struct
 {
-	bartender_t *bartender;
+	uint8_t cmd; /**< the command code the error is responding to or BLANK */
+	uint8_t seq; /**< the sequence id of the command or BLANK */
+	uint8_t code; /**< the error response code */
+} handler_reject_t;
+
+/**
+ * A structure that represents a message handler
+ */
+typedef struct
+{
+	bartender_t *bartender; /**< the bartender that commands are performed on */
+	uint8_t active; /**< the command that is waiting to complete or BLANK */
+	uint8_t seq; /**< the sequence id of the command that is waiting to complete */
+	volatile uint8_t link; /**< the state of the baud rate switch as defined by the link
+	 	 	 	 	 	 	 definitions found in this file */
+	unsigned long link_baud; /**< the baud rate that is being switched to */
+	unsigned long link_prev; /**< the baud rate to go back to if the switch fails */
+	uint8_t link_seq; /**< the sequence id of the baud command */
+	volatile uint8_t stop_pending; /**< true while the ok response of a stop command
+	 	 	 	 	 	 	 	 	 has not been sent */
+	uint8_t stop_seq; /**< the sequence id of the stop command */
+	handler_reject_t rejects[HANDLER_REJECTS]; /**< the error responses that have not been sent */
+	ring_t reject_ring; /**< the head and the tail of the error responses */
+	uint16_t rejects_lost; /**< the number of error responses that were thrown away
+	 	 	 	 	 	 	 because there was no room for them */
+	unsigned long link_started; /**< the time the baud rate was switched (in milliseconds) */
 } handler_t;
 
 /**
@@ -47,26 +129,136 @@ typedef struct
  */
 void handler_init(handler_t *handler, bartender_t *bartender);
 
+/**
+ * @name    Check Received Message
+ * @brief   Validates a message before it is handled.
+ * @ingroup handler
+ *
+ * Makes sure that the message is well formed, is a command that the handler
+ * knows about and that its parameters are in range. If the message is not
+ * valid the error response is queued with handler_reject(). This lets a
+ * command be rejected when it is received instead of when it reaches the
+ * front of the queue. This function does not write to the serial connection
+ * so it is safe to call from an ISR.
+ *
+ * @param [in] handler the instance of the handler that will be doing the
+ * checking
+ * @param [in] cmd the command to be checked. It must be a complete message
+ *
+ * @retval RSP_OK the command is valid
+ * @returns the error response code that was sent if the command is not valid
+ */
+uint8_t handler_check(handler_t *handler, uint8_t *cmd);
+
+/**
+ * @name    Reject a Command
+ * @brief   Queues an error response.
+ * @ingroup handler
+ *
+ * The error response is sent by the next call to handler_update(). This is
+ * how the receive interrupt answers without touching the tx buffer that the
+ * main loop writes to. If too many error responses are waiting the new one
+ * is thrown away and counted in rejects_lost. It is safe to call from an ISR.
+ *
+ * @param [in] handler the instance of the handler that will send the error
+ * @param [in] cmd the command code the error is responding to or BLANK
+ * @param [in] seq the sequence id of the command or BLANK
+ * @param [in] code the error response code
+ *
+ */
+void handler_reject(handler_t *handler, uint8_t cmd, uint8_t seq, uint8_t code);
+
+/**
+ * @name    Handler Stop
+ * @brief   Stops the bartender for a stop command.
+ * @ingroup handler
+ *
+ * The bartender is stopped right away and the ok response is sent by the
+ * next call to handler_update(). It is safe to call from an ISR.
+ *
+ * @param [in] handler the instance of the handler that received the command
+ * @param [in] cmd the stop command. It must be a complete message
+ *
+ */
+void handler_stop(handler_t *handler, uint8_t *cmd);
+
 /**
  * @name    Handle Received Message
  * @brief   Calls the bartender function specified by the message.
  * @ingroup handler
  *
  * This is the main function of the handle functions. It takes in a message
- * of length MSG_SIZE and calls the bartender function specified by the inputed
- * message. This function handles if the message is malformed and will send back
- * a response of RSP_MAL_MSG if the message is malformed. Please note that this
- * function is blocking. An example is if a message of CMD_MOVE is passed in to
- * the handler the function will not return until the drink plate has moved to
- * the new location.
+ * and calls the bartender function specified by the inputed
+ * message. This function handles if the message is malformed and will queue
+ * a response of RSP_MAL_MSG if the message is malformed. Commands that take
+ * a long time only get started by this function. An example is if a message of
+ * CMD_MOVE is passed in to the handler the function will start the move and
+ * return. The complete response is sent by handler_update() once the drink plate
+ * has moved to the new location.
  *
  * @param [in] handler the instance of the handler that will be doing the
  * processing
- * @param [in] cmd the command to be processed. Its length must be MSG_SIZE
+ * @param [in] cmd the command to be processed. It must be a complete message
  *
  */
 void handler_handle(handler_t *handler, uint8_t *cmd);
 
+/**
+ * @name    Update Handler
+ * @brief   Finishes the command that is in progress.
+ * @ingroup handler
+ *
+ * Checks on the command that is in progress and sends the complete response
+ * (or an error response) once the bartender has finished it. The error
+ * responses from handler_reject(), the ok response of a stop and the events
+ * that the bartender has recorded are sent first. It also carries
+ * out a baud rate switch that CMD_BAUD has accepted. This function should be
+ * called from the main loop.
+ *
+ * @param [in] handler the instance of the handler that will be updated
+ *
+ */
+void handler_update(handler_t *handler);
+
+/**
+ * @name    Handler Link Ok
+ * @brief   Lets the handler know that a valid message was received.
+ * @ingroup handler
+ *
+ * This confirms a baud rate switch that is waiting for a message at the new
+ * rate. It should be called for every message that the parser assembles. It
+ * is safe to call from an ISR.
+ *
+ * @param [in] handler the instance of the handler that received the message
+ *
+ */
+void handler_link_ok(handler_t *handler);
+
+/**
+ * @name    Handler Priority
+ * @brief   Gets the priority class of a command.
+ * @ingroup handler
+ *
+ * @param [in] cmd the command code
+ *
+ * @returns one of the PRIORITY_* classes found in this file
+ */
+uint8_t handler_priority(uint8_t cmd);
+
+/**
+ * @name    Handler Busy
+ * @brief   Sees if the handler has a command in progress.
+ * @ingroup handler
+ *
+ * The next motion or maintenance command should not be handled until this
+ * function returns false. Queries may be handled at any time.
+ *
+ * @param [in] handler the instance of the handler that will be checked
+ *
+ * @returns non zero if a command is in progress
+ */
+uint8_t handler_busy(handler_t *handler);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,81 @@
+#include "idle.h"
+
+#include "Arduino.h"
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+idle_stats_t idle_stats;
+
+/**
+ * Set by the ISRs when there is work for the main loop
+ */
+static volatile uint8_t pending = 0;
+
+/**
+ * The time of the first notify that the main loop has not picked up (in
+ * microseconds)
+ */
+static unsigned long notified = 0;
+
+void idle_init()
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
+	pending = 0;
+	idle_stats.wakes = 0;
+	idle_stats.work_wakes = 0;
+	idle_stats.latency = 0;
+	idle_stats.latency_max = 0;
+}
+
+void idle_notify()
+{
+	// Only the first one counts for the latency
+	if (!pending)
+	{
+		notified = micros();
+		pending = 1;
+	}
+}
+
+uint8_t idle_wait()
+{
+	cli();
+
+	if (!pending)
+	{
+		// The instruction after sei() runs before any interrupt so we can't
+		// miss a notify between the check and the sleep
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+
+	sei();
+
+	idle_stats.wakes++;
+
+	uint8_t work = 0;
+	unsigned long started = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		work = pending;
+		started = notified;
+		pending = 0;
+	}
+
+	if (work)
+	{
+		unsigned long latency = micros() - started;
+
+		idle_stats.work_wakes++;
+		idle_stats.latency = (uint16_t) min(latency, 0xFFFFUL);
+		idle_stats.latency_max = max(idle_stats.latency_max, idle_stats.latency);
+	}
+
+	return work;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file   idle.h
+ * @brief  Defines how the main loop sleeps until there is work to do.
+ *
+ * The main loop puts the processor in idle sleep between passes. Any interrupt
+ * wakes it up. The ISRs that leave work for the main loop (a message was
+ * received, a move has finished, the bump sensor was hit) call idle_notify()
+ * which sets the pending work flag. idle_wait() checks the flag with interrupts
+ * disabled and only sleeps if it is clear so work that arrives right before the
+ * sleep is never missed. The Timer0 interrupt that keeps millis() going still
+ * wakes the loop about once a millisecond so the timed phases of a pour are
+ * checked without any work being flagged.
+ *
+ * The number of wakes and the time from idle_notify() until the main loop picks
+ * up the work (the dispatch latency) are counted in idle_stats.
+ */
+#ifndef IDLE_H_
+#define IDLE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+
+/**
+ * The counters of the main loop
+ */
+typedef struct
+{
+	unsigned long wakes; /**< the number of times the main loop has woken up */
+	unsigned long work_wakes; /**< the number of wakes that found work flagged */
+	uint16_t latency; /**< the last dispatch latency (in microseconds) */
+	uint16_t latency_max; /**< the largest dispatch latency (in microseconds) */
+} idle_stats_t;
+
+/**
+ * The counters of the main loop
+ */
+extern idle_stats_t idle_stats;
+
+/**
+ * @name    Initialize Idle
+ * @brief   Selects the idle sleep mode and clears the counters.
+ * @ingroup idle
+ */
+void idle_init();
+
+/**
+ * @name    Idle Notify
+ * @brief   Lets the main loop know that there is work to do.
+ * @ingroup idle
+ *
+ * The time of the first notify since the main loop last picked up work is
+ * kept for the dispatch latency. This function is meant to be called from
+ * an ISR.
+ */
+void idle_notify();
+
+/**
+ * @name    Idle Wait
+ * @brief   Sleeps until the next interrupt unless work is pending.
+ * @ingroup idle
+ *
+ * Returns right away if work has been flagged. Otherwise the processor sleeps
+ * in idle mode until any interrupt. The pending work flag is cleared before
+ * this function returns.
+ *
+ * @warning Do not call this function with interrupts disabled.
+ *
+ * @returns non zero if work had been flagged
+ */
+uint8_t idle_wait();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IDLE_H_ */
@@ -0,0 +1,140 @@
+#include "motion.h"
+
+static uint16_t motion_sqrt(uint32_t value);
+static uint16_t motion_delay(const motion_profile_t *profile, uint32_t vsq);
+
+/**
+ * Integer square root. Only shifts and adds so it is cheap on the AVR.
+ */
+static uint16_t motion_sqrt(uint32_t value)
+{
+	uint32_t root = 0;
+	uint32_t bit = 1UL << 30;
+
+	// Find the highest power of four that is less than the value
+	while (bit > value)
+	{
+		bit >>= 2;
+	}
+
+	while (bit != 0)
+	{
+		if (value >= root + bit)
+		{
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+
+		bit >>= 2;
+	}
+
+	return (uint16_t) root;
+}
+
+/**
+ * Converts a speed squared into a delay that is clamped to the profile's
+ * start and cruise delays.
+ */
+static uint16_t motion_delay(const motion_profile_t *profile, uint32_t vsq)
+{
+	uint16_t speed = motion_sqrt(vsq);
+
+	if (speed == 0)
+	{
+		return profile->start_delay;
+	}
+
+	uint32_t delay = 1000000UL / speed;
+
+	if (delay > profile->start_delay)
+	{
+		return profile->start_delay;
+	}
+
+	if (delay < profile->cruise_delay)
+	{
+		return profile->cruise_delay;
+	}
+
+	return (uint16_t) delay;
+}
+
+void motion_config_init(motion_config_t *config)
+{
+	config->start_delay = MOTION_START_DELAY;
+	config->cruise_delay = MOTION_CRUISE_DELAY;
+	config->accel = MOTION_ACCEL;
+	config->decel = MOTION_DECEL;
+}
+
+void motion_plan(motion_profile_t *profile, const motion_config_t *config, uint16_t steps)
+{
+	profile->steps = steps;
+	profile->step = 0;
+	profile->start_delay = config->start_delay;
+	profile->cruise_delay = config->cruise_delay;
+	profile->accel = config->accel;
+	profile->decel = config->decel;
+	profile->accel_steps = 0;
+	profile->decel_steps = 0;
+
+	uint32_t start_speed = 1000000UL / config->start_delay;
+	profile->start_vsq = start_speed * start_speed;
+
+	// No ramps so the whole move runs at the start speed
+	if (config->accel == 0 || config->decel == 0 || config->cruise_delay >= config->start_delay)
+	{
+		profile->cruise_delay = config->start_delay;
+		return;
+	}
+
+	uint32_t cruise_speed = 1000000UL / config->cruise_delay;
+	uint32_t ramp = cruise_speed * cruise_speed - profile->start_vsq;
+
+	uint32_t accel_steps = ramp / (2UL * config->accel);
+	uint32_t decel_steps = ramp / (2UL * config->decel);
+
+	// We can't reach the cruise speed so split the move between the ramps
+	if (accel_steps + decel_steps > steps)
+	{
+		accel_steps = ((uint32_t) steps * config->decel) / ((uint32_t) config->accel + config->decel);
+		decel_steps = steps - accel_steps;
+	}
+
+	profile->accel_steps = (uint16_t) accel_steps;
+	profile->decel_steps = (uint16_t) decel_steps;
+}
+
+uint16_t motion_next_delay(motion_profile_t *profile)
+{
+	uint16_t step = profile->step;
+
+	// We are past the end of the move so crawl
+	if (step >= profile->steps)
+	{
+		return profile->start_delay;
+	}
+
+	profile->step++;
+
+	// Accelerating
+	if (step < profile->accel_steps)
+	{
+		return motion_delay(profile, profile->start_vsq + 2UL * profile->accel * step);
+	}
+
+	// Decelerating
+	uint16_t remaining = profile->steps - step - 1;
+
+	if (remaining < profile->decel_steps)
+	{
+		return motion_delay(profile, profile->start_vsq + 2UL * profile->decel * remaining);
+	}
+
+	// Cruising
+	return profile->cruise_delay;
+}
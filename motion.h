@@ -0,0 +1,124 @@
+/**
+ * @file   motion.h
+ * @brief  Defines a trapezoidal motion planner for the stepper motor.
+ *
+ * The motion planner computes the delay between each step of a move so that
+ * the drink plate accelerates from a standstill, cruises and then decelerates
+ * back to a standstill at the end of the move. A move is described by a
+ * motion_config_t which holds the start speed (the speed that is safe from a
+ * standing start with a full glass), the cruise speed and the acceleration and
+ * deceleration rates. A motion_profile_t is planned for a given number of steps
+ * and then asked for the delay before each step.
+ *
+ * The speed at step n of a ramp follows v(n)^2 = v0^2 + 2 * a * n so no floating
+ * point math is needed. If the move is too short to reach the cruise speed the
+ * profile becomes triangular and the ramps are split in the ratio of the
+ * acceleration and deceleration rates.
+ */
+#ifndef MOTION_H_
+#define MOTION_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "inttypes.h"
+
+/**
+ * The default delay between steps at a standstill (in microseconds)
+ */
+#define MOTION_START_DELAY 3000
+
+/**
+ * The default delay between steps at cruise speed (in microseconds)
+ */
+#define MOTION_CRUISE_DELAY 1000
+
+/**
+ * The default acceleration (in steps per second per second)
+ */
+#define MOTION_ACCEL 2000
+
+/**
+ * The default deceleration (in steps per second per second)
+ */
+#define MOTION_DECEL 2000
+
+/**
+ * The configuration of a move
+ */
+typedef struct
+{
+	uint16_t start_delay; /**< the delay between steps at a standstill (in microseconds) */
+	uint16_t cruise_delay; /**< the delay between steps at cruise speed (in microseconds) */
+	uint16_t accel; /**< the acceleration (in steps per second per second) */
+	uint16_t decel; /**< the deceleration (in steps per second per second) */
+} motion_config_t;
+
+/**
+ * A planned move
+ */
+typedef struct
+{
+	uint16_t steps; /**< the number of steps in the move */
+	uint16_t step; /**< the number of steps that have been taken */
+	uint16_t accel_steps; /**< the number of steps spent accelerating */
+	uint16_t decel_steps; /**< the number of steps spent decelerating */
+	uint32_t start_vsq; /**< the start speed squared (in steps^2/s^2) */
+	uint16_t start_delay; /**< the delay between steps at a standstill */
+	uint16_t cruise_delay; /**< the delay between steps at cruise speed */
+	uint16_t accel; /**< the acceleration of the move */
+	uint16_t decel; /**< the deceleration of the move */
+} motion_profile_t;
+
+/**
+ * @name    Motion Config Initialization
+ * @brief   Sets up the default values for the motion config structure.
+ * @ingroup motion
+ *
+ * Sets the config to the MOTION_START_DELAY, MOTION_CRUISE_DELAY,
+ * MOTION_ACCEL and MOTION_DECEL defaults.
+ *
+ * @param [in] config the config that will be initialized
+ */
+void motion_config_init(motion_config_t *config);
+
+/**
+ * @name    Motion Plan
+ * @brief   Plans a move of the given number of steps.
+ * @ingroup motion
+ *
+ * Computes the length of the acceleration and the deceleration ramps of a
+ * move. After this function is called motion_next_delay() will return the
+ * delay before each step of the move.
+ *
+ * @param [out] profile the profile that will be planned
+ * @param [in] config the speeds and rates of the move
+ * @param [in] steps the number of steps in the move
+ */
+void motion_plan(motion_profile_t *profile, const motion_config_t *config, uint16_t steps);
+
+/**
+ * @name    Motion Next Delay
+ * @brief   Returns the delay before the next step of the move.
+ * @ingroup motion
+ *
+ * Returns the delay before the next step of the move and advances the profile
+ * by one step.
+ *
+ * @note If more steps are taken than the move was planned for the start delay
+ * is returned. This lets a homing move crawl at the safe speed until it hits
+ * the bump sensor.
+ *
+ * @param [in] profile the planned move
+ *
+ * @returns the delay before the next step (in microseconds)
+ */
+uint16_t motion_next_delay(motion_profile_t *profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MOTION_H_ */
@@ -0,0 +1,206 @@
+#include "parser.h"
+#include "protocol.h"
+
+/**
+ * Looking for the start byte
+ */
+#define STATE_HUNT 0x00
+
+/**
+ * Expecting the length section
+ */
+#define STATE_LEN 0x01
+
+/**
+ * Collecting the rest of the message
+ */
+#define STATE_BODY 0x02
+
+static void parser_start(parser_t *parser, uint8_t *buffer);
+static uint8_t parser_step(parser_t *parser, uint8_t *buffer, uint8_t byte);
+static void parser_hold(parser_t *parser, uint8_t *buffer);
+static uint8_t parser_result(parser_t *parser, uint8_t *buffer, uint8_t result);
+
+void parser_init(parser_t *parser)
+{
+	parser->state = STATE_HUNT;
+	parser->size = 0;
+	parser->length = 0;
+	parser->errors = 0;
+	parser->held_count = 0;
+	parser->held_next = 0;
+}
+
+uint8_t parser_idle(parser_t *parser)
+{
+	return parser->state == STATE_HUNT;
+}
+
+/**
+ * Starts a new message with the start byte
+ */
+static void parser_start(parser_t *parser, uint8_t *buffer)
+{
+	buffer[I_START] = MSG_START;
+	parser->size = 1;
+	parser->state = STATE_LEN;
+}
+
+/**
+ * Runs the state machine for one byte. On an error the bytes of the bad
+ * message are left in the buffer and size is how many there are.
+ */
+static uint8_t parser_step(parser_t *parser, uint8_t *buffer, uint8_t byte)
+{
+	switch (parser->state)
+	{
+	case STATE_HUNT:
+		if (byte == MSG_START)
+		{
+			parser_start(parser, buffer);
+		}
+		return PARSER_MORE;
+
+	case STATE_LEN:
+		buffer[parser->size++] = byte;
+
+		// The message would not fit so it can't be a real one
+		if (byte > MSG_MAX_PAYLOAD)
+		{
+			parser->state = STATE_HUNT;
+			return PARSER_ERROR;
+		}
+
+		parser->length = MSG_FRAME_SIZE(byte);
+		parser->state = STATE_BODY;
+		return PARSER_MORE;
+
+	default:
+		buffer[parser->size++] = byte;
+
+		if (parser->size < parser->length)
+		{
+			return PARSER_MORE;
+		}
+
+		parser->state = STATE_HUNT;
+
+		// The stop byte has to be where the length says it is
+		if (byte != MSG_END)
+		{
+			return PARSER_ERROR;
+		}
+
+		parser->size = 0;
+		return PARSER_FRAME;
+	}
+}
+
+/**
+ * Holds back the bytes of a bad message from its next start byte on. They go
+ * in front of the bytes that are still waiting since they were received first.
+ */
+static void parser_hold(parser_t *parser, uint8_t *buffer)
+{
+	uint8_t start = 1;
+
+	// Only a start byte can begin the next message
+	while (start < parser->size && buffer[start] != MSG_START)
+	{
+		start++;
+	}
+
+	uint8_t count = parser->size - start;
+	uint8_t rest = parser->held_count - parser->held_next;
+
+	// The bad message was assembled from held bytes so this only matters if
+	// the caller fed bytes without replaying
+	if (rest > MSG_SIZE - count)
+	{
+		rest = MSG_SIZE - count;
+	}
+
+	// Move the waiting bytes to the front and then behind the new ones
+	for (uint8_t i = 0; i < rest; i++)
+	{
+		parser->held[i] = parser->held[parser->held_next + i];
+	}
+
+	for (uint8_t i = rest; i > 0; i--)
+	{
+		parser->held[count + i - 1] = parser->held[i - 1];
+	}
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		parser->held[i] = buffer[start + i];
+	}
+
+	parser->held_count = count + rest;
+	parser->held_next = 0;
+	parser->size = 0;
+}
+
+/**
+ * Counts a bad message and holds back its bytes
+ */
+static uint8_t parser_result(parser_t *parser, uint8_t *buffer, uint8_t result)
+{
+	if (result == PARSER_ERROR)
+	{
+		parser->errors++;
+		parser_hold(parser, buffer);
+	}
+
+	return result;
+}
+
+uint8_t parser_feed(parser_t *parser, uint8_t *buffer, uint8_t byte)
+{
+	// The byte has to wait for the held bytes that came before it
+	if (parser->held_next < parser->held_count)
+	{
+		if (parser->held_count == MSG_SIZE && parser->held_next > 0)
+		{
+			// Make room at the end
+			uint8_t rest = parser->held_count - parser->held_next;
+
+			for (uint8_t i = 0; i < rest; i++)
+			{
+				parser->held[i] = parser->held[parser->held_next + i];
+			}
+
+			parser->held_count = rest;
+			parser->held_next = 0;
+		}
+
+		// The caller did not replay so the byte can only be dropped
+		if (parser->held_count < MSG_SIZE)
+		{
+			parser->held[parser->held_count++] = byte;
+		}
+
+		return parser_replay(parser, buffer);
+	}
+
+	return parser_result(parser, buffer, parser_step(parser, buffer, byte));
+}
+
+uint8_t parser_replay(parser_t *parser, uint8_t *buffer)
+{
+	while (parser->held_next < parser->held_count)
+	{
+		uint8_t result = parser_step(parser, buffer, parser->held[parser->held_next++]);
+
+		if (result != PARSER_MORE)
+		{
+			return parser_result(parser, buffer, result);
+		}
+	}
+
+	// Everything has been replayed
+	parser->held_count = 0;
+	parser->held_next = 0;
+
+	return PARSER_MORE;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file   parser.h
+ * @brief  Defines a parser that assembles messages from the serial byte stream.
+ *
+ * The parser is fed one byte at a time and assembles the bytes into a message.
+ * It hunts for MSG_START, reads the length section and then collects the rest of
+ * the message. A message is only accepted if its last byte is MSG_END.
+ *
+ * If the length is too large or the stop byte is wrong the message is reported
+ * with PARSER_ERROR but the bytes are not just thrown away. The bytes after its
+ * start byte are held back in the parser and replayed with parser_replay(). A
+ * dropped or an extra byte then only costs the message it landed in. Every
+ * message after it still comes out, even the ones that were already received as
+ * part of the bad one.
+ *
+ * After parser_feed() returns anything but PARSER_MORE the caller handles the
+ * result and then calls parser_replay() until it returns PARSER_MORE before the
+ * next byte is fed.
+ *
+ * The buffer that the message is assembled into is passed in with every byte.
+ * It can only be changed while parser_idle() is true.
+ */
+#ifndef PARSER_H_
+#define PARSER_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+#include "protocol.h"
+
+/**
+ * The byte was consumed and the message is not complete yet
+ */
+#define PARSER_MORE 0x00
+
+/**
+ * The byte completed a message
+ */
+#define PARSER_FRAME 0x01
+
+/**
+ * The byte showed that the message being assembled is malformed
+ */
+#define PARSER_ERROR 0x02
+
+/**
+ * A structure that represents a message parser
+ */
+typedef struct
+{
+	uint8_t state; /**< the section of the message the parser is expecting */
+	uint8_t size; /**< the number of bytes of the message that have been received */
+	uint8_t length; /**< the size of the message once the length section is known */
+	uint16_t errors; /**< the number of malformed messages that have been seen */
+	uint8_t held[MSG_SIZE]; /**< the bytes that are waiting to be replayed */
+	uint8_t held_count; /**< the number of bytes in held */
+	uint8_t held_next; /**< the next byte of held to replay */
+} parser_t;
+
+/**
+ * @name    Initialize the Parser
+ * @brief   Sets up the default values for the parser structure.
+ * @ingroup parser
+ *
+ * @param [in] parser the parser that will be initialized
+ */
+void parser_init(parser_t *parser);
+
+/**
+ * @name    Parser Idle
+ * @brief   Sees if the parser is between messages.
+ * @ingroup parser
+ *
+ * @param [in] parser the parser that will be checked
+ *
+ * @returns non zero if the parser is hunting for the start of a message
+ */
+uint8_t parser_idle(parser_t *parser);
+
+/**
+ * @name    Parser Feed
+ * @brief   Feeds the next byte of the stream to the parser.
+ * @ingroup parser
+ *
+ * Adds the byte to the message that is being assembled in the buffer. If the
+ * byte shows that the message is malformed PARSER_ERROR is returned and the bytes
+ * of the message after its start byte are held back to be replayed. If bytes
+ * are already held back the byte is added after them and they are replayed
+ * first.
+ *
+ * @param [in] parser the parser that the byte is fed to
+ * @param [in] buffer a buffer of at least MSG_SIZE bytes that the message is
+ * assembled in
+ * @param [in] byte the next byte of the stream
+ *
+ * @retval PARSER_MORE the message is not complete yet
+ * @retval PARSER_FRAME the buffer holds a complete message
+ * @retval PARSER_ERROR a malformed message was thrown away
+ */
+uint8_t parser_feed(parser_t *parser, uint8_t *buffer, uint8_t byte);
+
+/**
+ * @name    Parser Replay
+ * @brief   Replays the bytes that were held back after a malformed message.
+ * @ingroup parser
+ *
+ * Feeds the held back bytes to the parser until one of them completes or breaks
+ * a message. Call it after every result of parser_feed() or parser_replay() that
+ * is not PARSER_MORE. The buffer can be changed between the calls since the
+ * parser is between messages.
+ *
+ * @param [in] parser the parser whose bytes are replayed
+ * @param [in] buffer a buffer of at least MSG_SIZE bytes that the message is
+ * assembled in
+ *
+ * @retval PARSER_MORE every held back byte has been replayed
+ * @retval PARSER_FRAME the buffer holds a complete message
+ * @retval PARSER_ERROR a malformed message was thrown away
+ */
+uint8_t parser_replay(parser_t *parser, uint8_t *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARSER_H_ */
@@ -0,0 +1,73 @@
+/**
+ * @file   pins.h
+ * @brief  Defines the ports and pins that the motor drivers are wired to.
+ *
+ * The pins are bound at compile time so that the drivers can change all of
+ * their control lines with a single write to the port register instead of a
+ * digitalWrite() per line. digitalWrite() has to look up the port and the bit
+ * of the pin and turn off PWM on every call.
+ *
+ * The four control lines of the stepper must be on consecutive bits of the
+ * same port. The first control line is at bit STEPPER_SHIFT. The two control
+ * lines of the toggle driver must be on the same port. On the UNO digital pins
+ * 0-7 are PORTD bits 0-7.
+ */
+#ifndef PINS_H_
+#define PINS_H_
+
+#include <avr/io.h>
+
+// --------------------------------------------------------------------
+// Stepper
+// --------------------------------------------------------------------
+
+/**
+ * The port that the stepper control lines are on
+ */
+#define STEPPER_PORT PORTD
+
+/**
+ * The data direction register of the stepper port
+ */
+#define STEPPER_DDR DDRD
+
+/**
+ * The bit of the first stepper control line (digital pin 2)
+ */
+#define STEPPER_SHIFT PD2
+
+/**
+ * The bits of all four stepper control lines (digital pins 2-5)
+ */
+#define STEPPER_MASK (0x0F << STEPPER_SHIFT)
+
+// --------------------------------------------------------------------
+// Toggle Driver
+// --------------------------------------------------------------------
+
+/**
+ * The port that the toggle driver control lines are on
+ */
+#define TOGGLE_PORT PORTD
+
+/**
+ * The data direction register of the toggle driver port
+ */
+#define TOGGLE_DDR DDRD
+
+/**
+ * The bit of the first toggle driver control line (digital pin 6)
+ */
+#define TOGGLE_PIN1 PD6
+
+/**
+ * The bit of the second toggle driver control line (digital pin 7)
+ */
+#define TOGGLE_PIN2 PD7
+
+/**
+ * The bits of both toggle driver control lines
+ */
+#define TOGGLE_MASK ((1 << TOGGLE_PIN1) | (1 << TOGGLE_PIN2))
+
+#endif /* PINS_H_ */
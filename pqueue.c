@@ -0,0 +1,65 @@
+#include "pqueue.h"
+#include "error.h"
+
+void pqueue_init(pqueue_t *pqueue, queue_t *classes, uint8_t count)
+{
+	pqueue->classes = classes;
+	pqueue->count = count;
+}
+
+uint8_t pqueue_enqueue(pqueue_t *pqueue, uint8_t priority, const uint8_t *data)
+{
+	return queue_enqueue(&pqueue->classes[priority], data);
+}
+
+uint8_t *pqueue_reserve(pqueue_t *pqueue, uint8_t priority)
+{
+	return queue_reserve(&pqueue->classes[priority]);
+}
+
+uint8_t pqueue_commit(pqueue_t *pqueue, uint8_t priority)
+{
+	return queue_commit(&pqueue->classes[priority]);
+}
+
+uint8_t *pqueue_peek(pqueue_t *pqueue, uint8_t lowest, uint8_t *priority_out)
+{
+	// Highest class first
+	for (uint8_t i = 0; i <= lowest && i < pqueue->count; i++)
+	{
+		uint8_t *slot = queue_peek(&pqueue->classes[i]);
+
+		if (slot != 0)
+		{
+			*priority_out = i;
+			return slot;
+		}
+	}
+
+	return 0;
+}
+
+uint8_t pqueue_release(pqueue_t *pqueue, uint8_t priority, const uint8_t *slot)
+{
+	return queue_release(&pqueue->classes[priority], slot);
+}
+
+uint8_t pqueue_size(pqueue_t *pqueue)
+{
+	uint8_t size = 0;
+
+	for (uint8_t i = 0; i < pqueue->count; i++)
+	{
+		size += queue_size(&pqueue->classes[i]);
+	}
+
+	return size;
+}
+
+void pqueue_clear(pqueue_t *pqueue, uint8_t highest)
+{
+	for (uint8_t i = highest; i < pqueue->count; i++)
+	{
+		queue_clear(&pqueue->classes[i]);
+	}
+}
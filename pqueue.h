@@ -0,0 +1,153 @@
+/**
+ * @file   pqueue.h
+ * @brief  Defines a queue that serves its elements by priority class
+ *
+ * A priority queue is a list of queue_t, one for each priority class. Class 0
+ * is the highest priority. An element is added to the queue of its class so
+ * elements of the same class come out in the order they went in. pqueue_peek()
+ * looks at the classes from the highest down and returns the first element it
+ * finds. Each class has its own storage and capacity so a long backlog of one
+ * class can never take the room of another.
+ *
+ * The queue of a class can still be used in place with pqueue_reserve() and
+ * pqueue_commit(). Like queue_t the producer may run in an ISR while the
+ * consumer runs in the main loop.
+ */
+#ifndef PQUEUE_H_
+#define PQUEUE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+#include "queue.h"
+
+/**
+ * A structure that represents a priority queue
+ */
+typedef struct
+{
+	queue_t *classes; /**< the queue of each class. The first one is the highest priority. */
+	uint8_t count; /**< the number of classes */
+} pqueue_t;
+
+/**
+ * @name    Initialize the Priority Queue
+ * @brief   Sets up the default values for the priority queue structure.
+ * @ingroup pqueue
+ *
+ * The queue of every class must already be initialized with queue_init().
+ *
+ * @param [in] pqueue the priority queue that will be initialized
+ * @param [in] classes the queue of each class from the highest priority down
+ * @param [in] count the number of classes
+ */
+void pqueue_init(pqueue_t *pqueue, queue_t *classes, uint8_t count);
+
+/**
+ * @name    Enqueue an Item
+ * @brief   Copies a data element into the queue of a class.
+ * @ingroup pqueue
+ *
+ * @param [in] pqueue the priority queue that the element will be added to
+ * @param [in] priority the class of the element
+ * @param [in] data the data element that will be added
+ *
+ * @retval E_NO_ERROR if no error occurred and the item was added
+ * @retval E_BUFF_OVERFLOW if the queue of the class is full
+ */
+uint8_t pqueue_enqueue(pqueue_t *pqueue, uint8_t priority, const uint8_t *data);
+
+/**
+ * @name    Reserve a Slot
+ * @brief   Gets the slot where the next element of a class will be added.
+ * @ingroup pqueue
+ *
+ * See queue_reserve().
+ *
+ * @param [in] pqueue the priority queue that the slot belongs to
+ * @param [in] priority the class of the slot
+ *
+ * @returns a pointer to the slot or 0 if the queue of the class is full
+ */
+uint8_t *pqueue_reserve(pqueue_t *pqueue, uint8_t priority);
+
+/**
+ * @name    Commit a Slot
+ * @brief   Adds the reserved slot of a class to the queue.
+ * @ingroup pqueue
+ *
+ * See queue_commit().
+ *
+ * @param [in] pqueue the priority queue that the slot will be added to
+ * @param [in] priority the class of the slot
+ *
+ * @retval E_NO_ERROR if no error occurred and the slot was added
+ * @retval E_BUFF_OVERFLOW if the queue of the class is full
+ */
+uint8_t pqueue_commit(pqueue_t *pqueue, uint8_t priority);
+
+/**
+ * @name    Peek at an Item
+ * @brief   Gets the first element of the highest class that has one.
+ * @ingroup pqueue
+ *
+ * The classes from 0 to lowest are looked at in order. Classes below lowest
+ * are skipped so the caller can hold back the classes that have to wait.
+ *
+ * @param [in] pqueue the priority queue that will be looked at
+ * @param [in] lowest the lowest priority class that may be returned
+ * @param [out] priority_out the class of the element
+ *
+ * @returns a pointer to the element or 0 if those classes are empty
+ */
+uint8_t *pqueue_peek(pqueue_t *pqueue, uint8_t lowest, uint8_t *priority_out);
+
+/**
+ * @name    Release an Item
+ * @brief   Removes the first element of a class.
+ * @ingroup pqueue
+ *
+ * Pass the element and the class that pqueue_peek() returned. Nothing is
+ * removed if the class was cleared in the meantime. See queue_release().
+ *
+ * @param [in] pqueue the priority queue that the element will be removed from
+ * @param [in] priority the class of the element
+ * @param [in] slot the element that pqueue_peek() returned
+ *
+ * @retval E_NO_ERROR if no error occurred and the item was removed
+ * @retval E_EMPTY if the queue of the class is empty or the element is no
+ * longer at its front
+ */
+uint8_t pqueue_release(pqueue_t *pqueue, uint8_t priority, const uint8_t *slot);
+
+/**
+ * @name    Priority Queue Size
+ * @brief   Gets the number of elements in every class.
+ * @ingroup pqueue
+ *
+ * @param [in] pqueue the priority queue that will be counted
+ *
+ * @returns the number of elements in the priority queue
+ */
+uint8_t pqueue_size(pqueue_t *pqueue);
+
+/**
+ * @name    Clear Classes
+ * @brief   Removes every element of a class and of the classes below it.
+ * @ingroup pqueue
+ *
+ * The higher classes are not touched. See queue_clear().
+ *
+ * @param [in] pqueue the priority queue that will be cleared
+ * @param [in] highest the highest priority class that will be cleared
+ */
+void pqueue_clear(pqueue_t *pqueue, uint8_t highest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PQUEUE_H_ */
@@ -1,50 +1,119 @@
 #include "protocol.h"
 
-static void protocol_clear_buffer(uint8_t *buffer);
-static void protocol_add_endings(uint8_t *buffer);
-
+uint8_t protocol_payload_size(uint8_t cmd)
+{
+	switch (cmd)
+	{
+	case CMD_STOP:
+	case CMD_STATUS:
+	case CMD_LOCATION:
+	case CMD_RESET:
+	case CMD_CALIBRATE:
+	case CMD_STATS:
+		return 0;
+	case CMD_MOVE:
+		return LEN_MOVE;
+	case CMD_POUR:
+		return LEN_POUR;
+	case CMD_POUR_ML:
+		return LEN_POUR_ML;
+	case CMD_BAUD:
+		return LEN_BAUD;
+	case CMD_GET_PARAM:
+		return LEN_GET_PARAM;
+	case CMD_SET_PARAM:
+		return LEN_SET_PARAM;
+	case CMD_RECIPE:
+	case CMD_RECIPE_ADD:
+		return PAYLOAD_VARIABLE;
+	default:
+		return PAYLOAD_UNKNOWN;
+	}
+}
 
-static void protocol_add_endings(uint8_t *buffer)
+unsigned long protocol_baud_rate(uint8_t code)
 {
-	buffer[I_START] = MSG_START;
-	buffer[I_END] = MSG_END;
+	switch (code)
+	{
+	case BAUD_9600:
+		return 9600UL;
+	case BAUD_115200:
+		return 115200UL;
+	case BAUD_250000:
+		return 250000UL;
+	case BAUD_500000:
+		return 500000UL;
+	case BAUD_1000000:
+		return 1000000UL;
+	default:
+		return 0;
+	}
 }
 
-static void protocol_clear_buffer(uint8_t *buffer)
+/**
+ * Reserves a frame and writes everything but the content
+ */
+static uint8_t protocol_build_header(serial_frame_t *frame, uint8_t type, uint8_t cmd, uint8_t code, uint8_t seq, uint8_t len)
 {
-	for (uint8_t i = 0; i < MSG_SIZE; i++)
+	if (serial_reserve(frame, MSG_FRAME_SIZE(len)) != E_NO_ERROR)
 	{
-		buffer[i] = BLANK;
+		return E_BUFF_OVERFLOW;
 	}
+
+	serial_frame_put(frame, I_START, MSG_START);
+	serial_frame_put(frame, I_LEN, len);
+	serial_frame_put(frame, I_TYPE, type);
+	serial_frame_put(frame, I_CMD, cmd);
+	serial_frame_put(frame, I_RSP_CODE, code);
+	serial_frame_put(frame, I_SEQ, seq);
+	serial_frame_put(frame, I_END(len), MSG_END);
+
+	return E_NO_ERROR;
 }
 
-void protocol_build_error_rsp(uint8_t *buffer, uint8_t cmd, uint8_t code)
+uint8_t protocol_build_rsp(serial_frame_t *frame, uint8_t cmd, uint8_t seq, uint8_t code, uint8_t len)
 {
-	protocol_clear_buffer(buffer);
-	protocol_add_endings(buffer);
+	if (protocol_build_header(frame, TYPE_RSP, cmd, code, seq, len) != E_NO_ERROR)
+	{
+		return E_BUFF_OVERFLOW;
+	}
+
+	// Whatever the caller doesn't fill in goes out as zero
+	serial_frame_fill(frame, I_PAYLOAD, len, 0);
 
-	buffer[I_TYPE] = TYPE_RSP;
-	buffer[I_CMD] = cmd;
-	buffer[I_RSP_CODE] = code;
+	return E_NO_ERROR;
 }
 
-void protocol_build_ok_rsp(uint8_t *buffer, uint8_t cmd)
+uint8_t protocol_build_event(serial_frame_t *frame, uint8_t event, uint8_t seq)
 {
-	protocol_clear_buffer(buffer);
-	protocol_add_endings(buffer);
+	return protocol_build_header(frame, TYPE_EVT, event, BLANK, seq, LEN_EVT);
+}
+
+static uint8_t protocol_send_rsp(uint8_t cmd, uint8_t seq, uint8_t code)
+{
+	serial_frame_t frame;
+
+	if (protocol_build_header(&frame, TYPE_RSP, cmd, code, seq, 0) != E_NO_ERROR)
+	{
+		return E_BUFF_OVERFLOW;
+	}
 
-	buffer[I_TYPE] = TYPE_RSP;
-	buffer[I_CMD] = cmd;
-	buffer[I_RSP_CODE] = RSP_OK;
+	serial_commit(&frame);
+
+	return E_NO_ERROR;
 }
 
-void protocol_build_complete_rsp(uint8_t *buffer, uint8_t cmd)
+uint8_t protocol_send_error_rsp(uint8_t cmd, uint8_t seq, uint8_t code)
 {
-	protocol_clear_buffer(buffer);
-	protocol_add_endings(buffer);
+	return protocol_send_rsp(cmd, seq, code);
+}
 
-	buffer[I_TYPE] = TYPE_RSP;
-	buffer[I_CMD] = cmd;
-	buffer[I_RSP_CODE] = RSP_COMPLETE;
+uint8_t protocol_send_ok_rsp(uint8_t cmd, uint8_t seq)
+{
+	return protocol_send_rsp(cmd, seq, RSP_OK);
 }
 
+uint8_t protocol_send_complete_rsp(uint8_t cmd, uint8_t seq)
+{
+	return protocol_send_rsp(cmd, seq, RSP_COMPLETE);
+}
@@ -6,23 +6,32 @@
  * @date   April, 2014
  *
  * This is where the protocol between the bartender and the control device is defined. The
- * data is organized into structured format called a message. The message has a size of MSG_SIZE.
- * The message structure can be broken down into different sections as shown below.
+ * data is organized into structured format called a message. A message is MSG_OVERHEAD bytes
+ * plus the length of its content and is never larger than MSG_SIZE. The message structure can
+ * be broken down into different sections as shown below.
  *
- * [START] [TYPE] [CMD] [RSP_CODE] [CONTENT] [STOP]
+ * [START] [LEN] [TYPE] [CMD] [RSP_CODE] [SEQ] [CONTENT] [STOP]
  *
  * The first and the last section of a message are called the start and stop bytes and are
- * defined as MSG_START and MSG_END at location I_START and I_END respectively. The message
+ * defined as MSG_START and MSG_END at location I_START and I_END(len) respectively. The message
  * must have these start and stop bytes so in case we drop a byte during transmission we are
  * able to tell which message is malformed.
  *
+ * The next section is the length section at location I_LEN. It holds the number of bytes in
+ * the content section which starts at I_PAYLOAD. The length can be anywhere from 0 to
+ * MSG_MAX_PAYLOAD. Most commands have a fixed content length that is given by
+ * protocol_payload_size(). A move is 8 bytes on the wire and an ok response is 7 bytes.
+ * The recipe commands carry a list so their length is PAYLOAD_VARIABLE.
+ *
  * The next section is the Type section at location I_TYPE. The type header defined what kind
  * of message we are sending or receiving. If we are issuing a command then the type header is
  * set to TYPE_CMD and if we are responding to a command then the type header should be set to
- * TYPE_RSP.
+ * TYPE_RSP. Events that the bartender sends without being asked are set to TYPE_EVT.
  *
  * The next section is the command section at location I_CMD. The acceptable value of this command
- * is any of the command values (CMD_STOP, CMD_MOVE, CMD_POUR, CMD_STATUS, CMD_LOCATION). If
+ * is any of the command values (CMD_STOP, CMD_MOVE, CMD_POUR, CMD_STATUS, CMD_LOCATION, CMD_RESET,
+ * CMD_BAUD, CMD_RECIPE, CMD_RECIPE_ADD, CMD_CALIBRATE, CMD_GET_PARAM, CMD_SET_PARAM,
+ * CMD_POUR_ML, CMD_STATS). If
  * the message is of type TYPE_CMD then the command section represents the command that the
  * message is issuing. If the message is of type TYPE_RSP then the command section represents
  * the command that the message is responding to or BLANK if the response is not responding
@@ -33,22 +42,71 @@
  * like the http status code section.
  * If the message is of type TYPE_CMD then the response code section is BLANK.
  *
+ * The last header section is the sequence id at location I_SEQ. The control device picks
+ * the id of each command and the bartender copies it into every response to that command
+ * (RSP_OK, RSP_COMPLETE and the errors). This is how the control device tells apart the
+ * responses of two commands with the same command code. The rules for keeping more than
+ * one command in flight are:
+ *
+ * 1. Use ids 1-255 and don't reuse an id until its command has been fully answered. Id 0
+ *    (BLANK) is used by responses that do not belong to a command, like an RSP_MAL_MSG for
+ *    bytes that never made a message.
+ * 2. CMD_STOP takes effect the moment its last byte arrives. Every other command is queued by its
+ *    priority class (see PRIORITY_QUERY in handler.h). Queries (CMD_STATUS, CMD_LOCATION,
+ *    CMD_GET_PARAM, CMD_STATS and CMD_BAUD) are answered ahead of everything else, even while
+ *    a command is in progress. Motion commands are run next and maintenance commands (CMD_CALIBRATE
+ *    and CMD_SET_PARAM) once no motion commands are left. Each class has its own queue.
+ *    Up to SETTING_QUEUE_LIMIT motion commands can wait on top of the one being worked on.
+ *    A command that does not fit in its queue is answered with RSP_QUEUE_FULL right away
+ *    and is not run.
+ * 3. Commands of the same class are run in the order they arrived. Motion and maintenance
+ *    commands are run one at a time. Such a command sends its RSP_OK when it is started and
+ *    its RSP_COMPLETE (or error) when it is done. Query responses can come in between. A
+ *    command with a bad parameter is answered with its error when it arrives and is not
+ *    queued.
+ * 4. CMD_STOP throws away every queued motion and maintenance command without answering
+ *    it. Once its RSP_OK arrives, the command in progress is answered with RSP_ERROR and
+ *    every other one of those commands that has not been answered was dropped.
+ * 5. Events carry the id of the command that is in progress or BLANK if there is none.
+ *
+ * The bartender sends an event message (TYPE_EVT) whenever something happens that the
+ * control device may be waiting on. The command section holds the event code and the
+ * response code section is BLANK. The content holds the time and the position of the
+ * bartender when it happened (see EVT_TIME). The control device can track progress from
+ * the events instead of polling with CMD_STATUS.
+ *
  */
 
 #ifndef PROTOCOL_H_
 #define PROTOCOL_H_
 
 #include "inttypes.h"
+#include "serial.h"
 
 // -------------------------------------------------------------------------------------------
 // General Section
 // -------------------------------------------------------------------------------------------
 
 /**
- * The size of the message in bytes
+ * The maximum size of a message in bytes
  */
 #define MSG_SIZE 32
 
+/**
+ * The number of bytes in a message that are not content (the header and the stop byte)
+ */
+#define MSG_OVERHEAD 7
+
+/**
+ * The maximum length of the content of a message
+ */
+#define MSG_MAX_PAYLOAD (MSG_SIZE - MSG_OVERHEAD)
+
+/**
+ * The size of a message with the given content length
+ */
+#define MSG_FRAME_SIZE(len) (MSG_OVERHEAD + (len))
+
 /**
  * Default value if a message header is not required
  */
@@ -64,9 +122,9 @@
 #define I_START 0x00
 
 /**
- * Location of the stop byte
+ * Location of the stop byte of a message with the given content length
  */
-#define I_END 0x1F
+#define I_END(len) (I_PAYLOAD + (len))
 
 /**
  * Value of the start byte
@@ -78,6 +136,40 @@
  */
 #define MSG_END 0xFE
 
+// -------------------------------------------------------------------------------------------
+// Length Section
+// -------------------------------------------------------------------------------------------
+
+/**
+ * Location of the content length
+ */
+#define I_LEN 0x01
+
+/**
+ * Location of the first byte of the content
+ */
+#define I_PAYLOAD 0x06
+
+/**
+ * Returned by protocol_payload_size() for commands that are not defined
+ */
+#define PAYLOAD_UNKNOWN 0xFF
+
+/**
+ * Returned by protocol_payload_size() for commands whose content length
+ * changes from message to message
+ */
+#define PAYLOAD_VARIABLE 0xFE
+
+// -------------------------------------------------------------------------------------------
+// Sequence Section
+// -------------------------------------------------------------------------------------------
+
+/**
+ * Location of the sequence id
+ */
+#define I_SEQ 0x05
+
 // -------------------------------------------------------------------------------------------
 // Type Section
 // -------------------------------------------------------------------------------------------
@@ -85,7 +177,7 @@
 /**
  * Location of the type header
  */
-#define I_TYPE 0x01
+#define I_TYPE 0x02
 
 /**
  * Value if the message is a response
@@ -97,6 +189,11 @@
  */
 #define TYPE_CMD 0x02
 
+/**
+ * Value if the message is an event
+ */
+#define TYPE_EVT 0x03
+
 // -------------------------------------------------------------------------------------------
 // Command Section
 // -------------------------------------------------------------------------------------------
@@ -104,7 +201,7 @@
 /**
  * Location of the command byte
  */
-#define I_CMD 0x02
+#define I_CMD 0x03
 
 /**
  * Stop Command
@@ -125,12 +222,17 @@
 /**
  * The parameter of the move command. Must be in between 0-12.
  */
-#define PARAM_MOVE_LOC 0x04
+#define PARAM_MOVE_LOC I_PAYLOAD
+
+/**
+ * The content length of the move command
+ */
+#define LEN_MOVE 1
 
 /**
  * Pour Command <amount>
  *
- * Tells the bartender to pour an amount from the
+ * Tells the bartender to pour an amount of shots from the
  * current location
  */
 #define CMD_POUR 0x03
@@ -139,7 +241,31 @@
  * The parameter of the pour command. Defines the amount of shots to be poured
  * into the glass.
  */
-#define PARAM_POUR_AMOUNT 0x04
+#define PARAM_POUR_AMOUNT I_PAYLOAD
+
+/**
+ * The content length of the pour command
+ */
+#define LEN_POUR 1
+
+/**
+ * Pour Milliliters Command <ml low> <ml high>
+ *
+ * Tells the bartender to pour a volume (in milliliters) from the
+ * current location. The actuator is raised once and held up for as
+ * long as the flow of the location says the volume takes.
+ */
+#define CMD_POUR_ML 0x0D
+
+/**
+ * The parameter of the pour milliliters command (low byte first)
+ */
+#define PARAM_POUR_ML I_PAYLOAD
+
+/**
+ * The content length of the pour milliliters command
+ */
+#define LEN_POUR_ML 2
 
 /**
  * Status Command
@@ -147,7 +273,8 @@
  * Returns the status of the bartender. If the bartender
  * is busy executing a command, the response will be
  * RSP_BUSY but if the bartender is not executing a command
- * RSP_WAITING is returned
+ * RSP_WAITING is returned. The events (see EVT_ARRIVED) make
+ * polling with this command unnecessary.
  */
 #define CMD_STATUS 0x04
 
@@ -155,7 +282,12 @@
  * The response to the status command. Contains the current status of the
  * bartender.
  */
-#define RES_STATUS_STATUS 0x04
+#define RES_STATUS_STATUS I_PAYLOAD
+
+/**
+ * The content length of the response to the status command
+ */
+#define LEN_RES_STATUS 1
 
 /**
  * Location Command
@@ -164,6 +296,329 @@
  */
 #define CMD_LOCATION 0x05
 
+/**
+ * The response to the location command. Contains the current location of the
+ * bartender.
+ */
+#define RES_LOCATION_LOCATION I_PAYLOAD
+
+/**
+ * The content length of the response to the location command
+ */
+#define LEN_RES_LOCATION 1
+
+/**
+ * Reset Command
+ *
+ * Tells a stopped bartender to lower the pouring actuator and
+ * home the drink plate so that it can process commands again
+ */
+#define CMD_RESET 0x06
+
+/**
+ * Baud Command <rate>
+ *
+ * Asks the bartender to switch the serial connection to a faster
+ * baud rate. The switch works like this:
+ *
+ * 1. The control device sends CMD_BAUD at the current rate.
+ * 2. If the clock can't generate the rate the bartender sends back
+ *    RSP_ERROR and nothing changes. Otherwise it sends RSP_OK at the
+ *    current rate and switches once the response has been sent.
+ * 3. The control device switches and must send any valid message
+ *    (CMD_STATUS works well) within BAUD_TIMEOUT milliseconds.
+ * 4. When that message arrives the bartender sends RSP_COMPLETE for
+ *    CMD_BAUD at the new rate. If nothing arrives in time the bartender
+ *    goes back to the old rate and sends RSP_ERROR for CMD_BAUD there.
+ */
+#define CMD_BAUD 0x07
+
+/**
+ * The parameter of the baud command. One of the BAUD_* rate codes.
+ */
+#define PARAM_BAUD_RATE I_PAYLOAD
+
+/**
+ * The content length of the baud command
+ */
+#define LEN_BAUD 1
+
+/**
+ * Rate code for 9600 baud (the rate the bartender starts at)
+ */
+#define BAUD_9600 0x00
+
+/**
+ * Rate code for 115200 baud
+ */
+#define BAUD_115200 0x01
+
+/**
+ * Rate code for 250000 baud
+ */
+#define BAUD_250000 0x02
+
+/**
+ * Rate code for 500000 baud
+ */
+#define BAUD_500000 0x03
+
+/**
+ * Rate code for 1000000 baud
+ */
+#define BAUD_1000000 0x04
+
+/**
+ * How long the bartender waits for a valid message after switching the baud
+ * rate (in milliseconds)
+ */
+#define BAUD_TIMEOUT 1000
+
+/**
+ * Calibrate Command
+ *
+ * Tells the bartender to measure the rail with the bump sensor and
+ * rescale the distance to every location (see bartender_calibrate()).
+ * RSP_OK is sent when the calibration starts. The RSP_COMPLETE carries
+ * the new distance from home to each location.
+ */
+#define CMD_CALIBRATE 0x0A
+
+/**
+ * The response to the calibrate command. Contains the distance from home to
+ * each of the locations 1-12 in full steps. Home is always 0 so it is not
+ * sent. Each distance is two bytes, low byte first.
+ */
+#define RES_CALIBRATE_OFFSET(location) (I_PAYLOAD + (((location) - 1) << 1))
+
+/**
+ * The content length of the response to the calibrate command
+ */
+#define LEN_RES_CALIBRATE 24
+
+/**
+ * Get Param Command <id>
+ *
+ * Reads one of the settings defined in settings.h. The RSP_OK carries
+ * the value of the setting. RSP_ERROR is sent if there is no setting
+ * with the id.
+ */
+#define CMD_GET_PARAM 0x0B
+
+/**
+ * Set Param Command <id> <value low> <value high>
+ *
+ * Changes one of the settings defined in settings.h and saves every
+ * setting to the EEPROM. RSP_OK is sent once the setting has been
+ * saved. RSP_ERROR is sent if there is no setting with the id or the
+ * value is out of range.
+ */
+#define CMD_SET_PARAM 0x0C
+
+/**
+ * The id of the setting of the get param and set param commands
+ */
+#define PARAM_SETTING_ID I_PAYLOAD
+
+/**
+ * The value of the set param command (low byte first)
+ */
+#define PARAM_SETTING_VALUE (I_PAYLOAD + 1)
+
+/**
+ * The content length of the get param command
+ */
+#define LEN_GET_PARAM 1
+
+/**
+ * The content length of the set param command
+ */
+#define LEN_SET_PARAM 3
+
+/**
+ * The response to the get param command. Contains the value of the
+ * setting (low byte first).
+ */
+#define RES_PARAM_VALUE I_PAYLOAD
+
+/**
+ * The content length of the response to the get param command
+ */
+#define LEN_RES_PARAM 2
+
+/**
+ * Stats Command
+ *
+ * Returns the counters of the main loop and of the transmitter. The main
+ * loop sleeps until an interrupt wakes it up. The counters show how often it
+ * wakes up and how long a message waits before the main loop picks it up.
+ * Frames are written to the transmitter whole. The counters also show how
+ * many frames had to wait for room and how many were never sent.
+ */
+#define CMD_STATS 0x0E
+
+/**
+ * The response to the stats command. The number of times the main loop has
+ * woken up (four bytes, low byte first).
+ */
+#define RES_STATS_WAKES I_PAYLOAD
+
+/**
+ * The response to the stats command. The number of wakes that found work
+ * waiting (four bytes, low byte first).
+ */
+#define RES_STATS_WORK_WAKES (I_PAYLOAD + 4)
+
+/**
+ * The response to the stats command. The last dispatch latency in
+ * microseconds (two bytes, low byte first).
+ */
+#define RES_STATS_LATENCY (I_PAYLOAD + 8)
+
+/**
+ * The response to the stats command. The largest dispatch latency in
+ * microseconds (two bytes, low byte first).
+ */
+#define RES_STATS_LATENCY_MAX (I_PAYLOAD + 10)
+
+/**
+ * The response to the stats command. The number of frames that had to wait
+ * for room in the transmit buffer (two bytes, low byte first).
+ */
+#define RES_STATS_TX_DELAYED (I_PAYLOAD + 12)
+
+/**
+ * The response to the stats command. The number of frames that were thrown
+ * away because there was no room in the transmit buffer (two bytes, low byte
+ * first).
+ */
+#define RES_STATS_TX_DROPPED (I_PAYLOAD + 14)
+
+/**
+ * The response to the stats command. The number of events that were thrown
+ * away because too many were waiting to be sent (two bytes, low byte first).
+ */
+#define RES_STATS_EVENTS_LOST (I_PAYLOAD + 16)
+
+/**
+ * The response to the stats command. The number of error responses that were
+ * thrown away because too many were waiting to be sent (two bytes, low byte
+ * first).
+ */
+#define RES_STATS_REJECTS_LOST (I_PAYLOAD + 18)
+
+/**
+ * The content length of the response to the stats command
+ */
+#define LEN_RES_STATS 20
+
+/**
+ * Recipe Command <location> <shots> ...
+ *
+ * Tells the bartender to run a list of steps back to back. Each step
+ * is a location followed by the number of shots to pour there. The
+ * bartender moves to the location of a step, pours its shots and then
+ * goes on to the next step. RSP_OK is sent when the recipe starts and
+ * RSP_COMPLETE is sent once after the last step.
+ *
+ * Before starting, the bartender reorders the steps to cut down on travel.
+ * A step whose shots byte has bit 7 set (RECIPE_ORDERED) is order sensitive.
+ * It is made in the position it was given and no step is moved past it. The
+ * steps in between are sorted into one sweep along the rail. The RSP_OK
+ * carries the number of full steps of travel that were saved.
+ *
+ * A recipe that does not fit in one message is sent as CMD_RECIPE_ADD
+ * messages followed by a CMD_RECIPE with the last steps.
+ */
+#define CMD_RECIPE 0x08
+
+/**
+ * Recipe Add Command <location> <shots> ...
+ *
+ * Adds steps to the recipe that the next CMD_RECIPE runs. Sends RSP_OK
+ * once the steps have been stored. If the recipe is too long RSP_ERROR
+ * is sent and the stored steps are thrown away.
+ */
+#define CMD_RECIPE_ADD 0x09
+
+/**
+ * The location of the given step of a recipe command. Must be in between 0-12.
+ */
+#define PARAM_RECIPE_LOC(step) (I_PAYLOAD + ((step) << 1))
+
+/**
+ * The number of shots of the given step of a recipe command
+ */
+#define PARAM_RECIPE_SHOTS(step) (I_PAYLOAD + ((step) << 1) + 1)
+
+/**
+ * The content length of one step of a recipe command
+ */
+#define LEN_RECIPE_STEP 2
+
+/**
+ * The response to the recipe command. Contains the number of full steps of
+ * travel that reordering saved (low byte first).
+ */
+#define RES_RECIPE_SAVED I_PAYLOAD
+
+/**
+ * The content length of the response to the recipe command
+ */
+#define LEN_RES_RECIPE 2
+
+// --------------------------------------------------------
+// Event Section
+// --------------------------------------------------------
+
+/**
+ * The drink plate has reached a location. Sent once per move, at the end of
+ * every recipe move and when a reset or a calibration gets home.
+ */
+#define EVT_ARRIVED 0x01
+
+/**
+ * The pouring actuator has started its up stroke
+ */
+#define EVT_POUR_STARTED 0x02
+
+/**
+ * A pour has finished and the drink plate is free to move
+ */
+#define EVT_POUR_DONE 0x03
+
+/**
+ * The bartender has been stopped and needs CMD_RESET
+ */
+#define EVT_STOPPED 0x04
+
+/**
+ * The bump sensor has stopped the drink plate
+ */
+#define EVT_BUMP 0x05
+
+/**
+ * The time of the event in milliseconds since the bartender started. Four
+ * bytes, low byte first.
+ */
+#define EVT_TIME I_PAYLOAD
+
+/**
+ * The number of steps from home to the drink plate at the time of the event.
+ * Two bytes, low byte first.
+ */
+#define EVT_POSITION (I_PAYLOAD + 4)
+
+/**
+ * The location of the bartender at the time of the event
+ */
+#define EVT_LOCATION (I_PAYLOAD + 6)
+
+/**
+ * The content length of an event
+ */
+#define LEN_EVT 7
+
 // --------------------------------------------------------
 // Response Section
 // --------------------------------------------------------
@@ -171,7 +626,7 @@
 /**
  * Location of the response code
  */
-#define I_RSP_CODE 0x03
+#define I_RSP_CODE 0x04
 
 /**
  * We have received the command and it is of valid syntax
@@ -190,7 +645,7 @@
 
 /**
  * Malformed message error. Sent when a message is received that does not have the
- * start and stop byte.
+ * start and stop byte or whose content length is wrong for its command.
  */
 #define RSP_MAL_MSG 0x03
 
@@ -232,47 +687,112 @@ extern "C"
 #endif
 
 /**
- * @name    Protocol Build Error Response
- * @brief   Build a protocol error response
+ * @name    Protocol Payload Size
+ * @brief   Gets the content length of a command
+ * @ingroup protocol
+ *
+ * @param [in] cmd the command code
+ *
+ * @returns the content length of the command, PAYLOAD_VARIABLE if the length
+ * changes from message to message or PAYLOAD_UNKNOWN if the command is not defined
+ */
+uint8_t protocol_payload_size(uint8_t cmd);
+
+/**
+ * @name    Protocol Baud Rate
+ * @brief   Gets the baud rate of a rate code
+ * @ingroup protocol
+ *
+ * @param [in] code one of the BAUD_* rate codes
+ *
+ * @returns the baud rate or 0 if the code is not defined
+ */
+unsigned long protocol_baud_rate(uint8_t code);
+
+/**
+ * @name    Protocol Build Response
+ * @brief   Build a protocol response with content in the tx queue
+ * @ingroup protocol
+ *
+ * This function reserves the whole response in the tx queue and writes the header
+ * and the stop byte straight into it. The len bytes of content are set to zero so
+ * the caller only has to put in the fields it knows with serial_frame_put()
+ * starting at I_PAYLOAD. Nothing is sent until the caller calls serial_commit().
+ *
+ * @param [out] frame the frame that the response will be reserved in
+ * @param [in] cmd the command code that the message is responding to
+ * @param [in] seq the sequence id of the command
+ * @param [in] code the response code that the message should contain
+ * @param [in] len the length of the content
+ *
+ * @retval E_NO_ERROR the response was reserved and must be committed
+ * @retval E_BUFF_OVERFLOW the response could not be reserved and was dropped
+ */
+uint8_t protocol_build_rsp(serial_frame_t *frame, uint8_t cmd, uint8_t seq, uint8_t code, uint8_t len);
+
+/**
+ * @name    Protocol Build Event
+ * @brief   Build a protocol event in the tx queue
+ * @ingroup protocol
+ *
+ * This function reserves the whole event in the tx queue and writes the header
+ * and the stop byte straight into it. The caller puts in the LEN_EVT bytes of
+ * content with serial_frame_put() and then calls serial_commit().
+ *
+ * @param [out] frame the frame that the event will be reserved in
+ * @param [in] event the event code
+ * @param [in] seq the sequence id of the command in progress or BLANK
+ *
+ * @retval E_NO_ERROR the event was reserved and must be committed
+ * @retval E_BUFF_OVERFLOW the event could not be reserved and was dropped
+ */
+uint8_t protocol_build_event(serial_frame_t *frame, uint8_t event, uint8_t seq);
+
+/**
+ * @name    Protocol Send Error Response
+ * @brief   Send a protocol error response
  * @ingroup protocol
  *
- * This function build a protocol error response in the passed in parameter of buffer.
+ * This function builds a protocol error response in the tx queue and sends it.
  *
- * @param [out] buffer a buffer that is of length MSG_SIZE that the error response will be
- * written to
  * @param [in] cmd the command code that the error is responding to
+ * @param [in] seq the sequence id of the command or BLANK
  * @param [in] code the error response code that the message should contain
  *
+ * @retval E_NO_ERROR the response was sent
+ * @retval E_BUFF_OVERFLOW the response was dropped
  */
-void protocol_build_error_rsp(uint8_t *buffer, uint8_t cmd, uint8_t code);
+uint8_t protocol_send_error_rsp(uint8_t cmd, uint8_t seq, uint8_t code);
 
 /**
- * @name    Protocol Build Ok Response
- * @brief   Build a protocol ok response
+ * @name    Protocol Send Ok Response
+ * @brief   Send a protocol ok response
  * @ingroup protocol
  *
- * This function build a protocol ok response in the passed in parameter of buffer.
+ * This function builds a protocol ok response in the tx queue and sends it.
  *
- * @param [out] buffer a buffer that is of length MSG_SIZE that the response will be
- * written to
  * @param [in] cmd the command code that the message is responding to
+ * @param [in] seq the sequence id of the command
  *
+ * @retval E_NO_ERROR the response was sent
+ * @retval E_BUFF_OVERFLOW the response was dropped
  */
-void protocol_build_ok_rsp(uint8_t *buffer, uint8_t cmd);
+uint8_t protocol_send_ok_rsp(uint8_t cmd, uint8_t seq);
 
 /**
- * @name    Protocol Build Complete Response
- * @brief   Build a protocol complete response
+ * @name    Protocol Send Complete Response
+ * @brief   Send a protocol complete response
  * @ingroup protocol
  *
- * This function build a protocol complete response in the passed in parameter of buffer.
+ * This function builds a protocol complete response in the tx queue and sends it.
  *
- * @param [out] buffer a buffer that is of length MSG_SIZE that the response will be
- * written to
  * @param [in] cmd the command code that the message is responding to
+ * @param [in] seq the sequence id of the command
  *
+ * @retval E_NO_ERROR the response was sent
+ * @retval E_BUFF_OVERFLOW the response was dropped
  */
-void protocol_build_complete_rsp(uint8_t *buffer, uint8_t cmd);
+uint8_t protocol_send_complete_rsp(uint8_t cmd, uint8_t seq);
 
 #ifdef __cplusplus
 }
@@ -1,74 +1,152 @@
 #include "queue.h"
 #include "error.h"
 
-void queue_init(queue_t *queue, uint8_t *data, uint8_t data_size, uint8_t capacity)
+#include <util/atomic.h>
+
+#if !RING_VALID_CAPACITY(QUEUE_CAPACITY)
+#error "The queue capacity must be a power of two no larger than 128"
+#endif
+
+void queue_init(queue_t *queue, uint8_t *data, uint8_t data_size, uint8_t limit)
 {
 	queue->data = data;
 	queue->data_size = data_size;
+	queue->limit = limit;
 
-	queue->capacity = capacity;
-	queue->size = 0;
-
-	queue->head = 0;
-	queue->tail = 0;
+	ring_init(&queue->ring);
+	queue->reading = 0;
+	queue->pinned = 0;
 }
 
 uint8_t queue_enqueue(queue_t *queue, const uint8_t *data)
 {
+	uint8_t *slot = queue_reserve(queue);
+
 	// Check to make sure that we do not overflow
-	if (queue->size + 1 > queue->capacity)
+	if (slot == 0)
 	{
 		return E_BUFF_OVERFLOW;
 	}
 
-	// Get the starting index
-	uint16_t realIndex = queue->head * queue->data_size;
-
 	// Iterate the input buffer
 	for (uint8_t i = 0; i < queue->data_size; i++)
 	{
-		queue->data[realIndex] = data[i];
-		realIndex++;
+		slot[i] = data[i];
 	}
 
-	// Calculate the new head
-	queue->head = (queue->head + 1) % queue->capacity;
-	queue->size++;
-
-	return E_NO_ERROR;
+	return queue_commit(queue);
 }
 
 uint8_t queue_dequeue(queue_t *queue, uint8_t *data)
 {
+	uint8_t *slot = queue_peek(queue);
+
 	// Make sure there is something to dequeue
-	if (queue->size == 0)
+	if (slot == 0)
 	{
 		return E_EMPTY;
 	}
 
-	// Get the starting index
-	uint16_t realIndex = queue->tail * queue->data_size;
-
-	// Iterate the input buffer
+	// Iterate the output buffer
 	for (uint8_t i = 0; i < queue->data_size; i++)
 	{
-		data[i] = queue->data[realIndex];
-		realIndex++;
+		data[i] = slot[i];
 	}
 
-	// Calculate the new tail
-	queue->tail = (queue->tail + 1) % queue->capacity;
-	queue->size--;
+	return queue_release(queue, slot);
+}
+
+uint8_t queue_size(queue_t *queue)
+{
+	return ring_count(&queue->ring);
+}
+
+uint8_t *queue_reserve(queue_t *queue)
+{
+	// Check to make sure that we do not overflow
+	if (ring_full(&queue->ring, queue->limit))
+	{
+		return 0;
+	}
+
+	uint8_t head = ring_head(&queue->ring, QUEUE_CAPACITY);
+
+	// A clear can leave the slot that is being read at the head
+	if (queue->reading && head == queue->pinned)
+	{
+		return 0;
+	}
+
+	return &queue->data[(uint16_t) head * queue->data_size];
+}
+
+uint8_t queue_commit(queue_t *queue)
+{
+	// Check to make sure that we do not overflow
+	if (ring_full(&queue->ring, queue->limit))
+	{
+		return E_BUFF_OVERFLOW;
+	}
+
+	ring_push(&queue->ring);
 
 	return E_NO_ERROR;
 }
 
-uint8_t queue_clear(queue_t *queue)
+uint8_t *queue_peek(queue_t *queue)
+{
+	uint8_t *slot = 0;
+
+	// queue_clear() may move the tail from an ISR
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Make sure there is something to look at
+		if (!ring_empty(&queue->ring))
+		{
+			// Keep the slot from the producer until it is released
+			queue->pinned = ring_tail(&queue->ring, QUEUE_CAPACITY);
+			queue->reading = 1;
+
+			slot = &queue->data[(uint16_t) queue->pinned * queue->data_size];
+		}
+	}
+
+	return slot;
+}
+
+uint8_t queue_release(queue_t *queue, const uint8_t *slot)
 {
-	queue->head = 0;
-	queue->tail = 0;
+	uint8_t code = E_NO_ERROR;
+
+	// queue_clear() may move the tail from an ISR
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		uint8_t *tail = &queue->data[(uint16_t) ring_tail(&queue->ring, QUEUE_CAPACITY) * queue->data_size];
+
+		// Make sure there is something to release and that it is still the
+		// element that was peeked at
+		if (ring_empty(&queue->ring) || tail != slot)
+		{
+			code = E_EMPTY;
+		}
+		else
+		{
+			ring_pop(&queue->ring);
+		}
+
+		// The producer may have the slot back either way
+		queue->reading = 0;
+	}
 
-	queue->size = 0;
+	return code;
+}
+
+uint8_t queue_clear(queue_t *queue)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		queue->ring.tail = queue->ring.head;
+	}
 
 	return E_NO_ERROR;
 }
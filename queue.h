@@ -6,7 +6,17 @@
  *
  * These queue functions are implemented using a ring buffer. The buffer has a
  * head which is where the the next element is inserted. It also has a tail which
- * is the position where the next element to be dequeued is stored.
+ * is the position where the next element to be dequeued is stored. The head and
+ * the tail are kept by a ring_t. Every queue has QUEUE_CAPACITY slots so the
+ * slot of the head or the tail is found with a mask that is known at compile
+ * time. A queue can be made to hold fewer elements with its limit.
+ *
+ * Elements can also be used in place without being copied. A producer calls
+ * queue_reserve() to get the slot at the head, writes the element straight into
+ * it and then calls queue_commit() to add it to the queue. A consumer calls
+ * queue_peek() to get the slot at the tail, reads the element in place and then
+ * calls queue_release() to remove it. The producer may run in an ISR while the
+ * consumer runs in the main loop.
  */
 #ifndef QUEUE_H_
 #define QUEUE_H_
@@ -17,6 +27,15 @@ extern "C"
 #endif
 
 #include <inttypes.h>
+#include "ring.h"
+
+/**
+ * The number of data elements the buffer of every queue holds. Must be a
+ * power of two no larger than 128.
+ */
+#ifndef QUEUE_CAPACITY
+#define QUEUE_CAPACITY 8
+#endif
 
 /**
  * A structure that represents a queue that uses a ring buffer to hold its
@@ -27,11 +46,11 @@ typedef struct
 	uint8_t *data; /**< the buffer used to store data elements */
 	uint8_t data_size; /**< the size of the data elements */
 
-	uint8_t capacity; /**< the number of data elements the buffer can hold  */
-	uint8_t size; /**< the number of data elements currently in the queue */
-
-	uint8_t head; /**< the index of the first element in the queue */
-	uint8_t tail; /**< the index of the last element in the queue  */
+	uint8_t limit; /**< the most data elements the queue will hold. No larger than
+	 	 	 	 	 QUEUE_CAPACITY. */
+	ring_t ring; /**< the head and the tail of the queue */
+	volatile uint8_t reading; /**< non zero while the consumer reads the pinned slot */
+	volatile uint8_t pinned; /**< the slot that queue_peek() handed out last */
 } queue_t;
 
 /**
@@ -42,12 +61,15 @@ typedef struct
  * Sets up a queue_t.
  *
  * @param [in] queue the queue that will be initialized
- * @param [in] data the buffer used to store the values of the queue
+ * @param [in] data the buffer used to store the values of the queue. It must
+ * hold QUEUE_CAPACITY elements.
  * @param [in] data_size the fixed size in bytes of the elements of the queue
- * @param [in] capacity how many data elements the buffer can hold
+ * @param [in] limit the most data elements the queue will hold
+ *
+ * @warning The limit must be between 1 and QUEUE_CAPACITY.
  *
  */
-void queue_init(queue_t *queue, uint8_t *data, uint8_t data_size, uint8_t capacity);
+void queue_init(queue_t *queue, uint8_t *data, uint8_t data_size, uint8_t limit);
 
 /**
  * @name    Enqueue an Item
@@ -57,14 +79,14 @@ void queue_init(queue_t *queue, uint8_t *data, uint8_t data_size, uint8_t capaci
  * Adds an element to the back of the queue.
  *
  * @warning This function returns E_BUFF_OVERFLOW if adding another
- * element to the queue exceeds the buffer capacity.
+ * element to the queue exceeds the limit of the queue.
  *
  * @param [in] queue the queue that the element will be added to
  * @param [in] data the data element that will be added to the queue
  *
  * @retval E_NO_ERROR if no error occurred and the item was successfully added.
  * @retval E_BUFF_OVERFLOW if adding another element would exceed the queue's
- * capacity
+ * limit
  *
  */
 uint8_t queue_enqueue(queue_t *queue, const uint8_t *data);
@@ -87,6 +109,96 @@ uint8_t queue_enqueue(queue_t *queue, const uint8_t *data);
  */
 uint8_t queue_dequeue(queue_t *queue, uint8_t *data);
 
+/**
+ * @name    Queue Size
+ * @brief   Gets the number of elements in the queue.
+ * @ingroup queue
+ *
+ * @param [in] queue the queue that will be counted
+ *
+ * @returns the number of elements in the queue
+ *
+ */
+uint8_t queue_size(queue_t *queue);
+
+/**
+ * @name    Reserve a Slot
+ * @brief   Gets the slot where the next element will be added.
+ * @ingroup queue
+ *
+ * Returns the slot at the back of the queue so that an element can be written
+ * into it in place. The element is not part of the queue until queue_commit()
+ * is called. Calling this function again before committing returns the same
+ * slot. The slot that the consumer is reading is never handed out, even if
+ * the queue was cleared.
+ *
+ * @param [in] queue the queue that the slot belongs to
+ *
+ * @returns a pointer to a slot of data_size bytes or 0 if the queue is full or
+ * the slot is still being read
+ *
+ */
+uint8_t *queue_reserve(queue_t *queue);
+
+/**
+ * @name    Commit a Slot
+ * @brief   Adds the reserved slot to the queue.
+ * @ingroup queue
+ *
+ * Adds the element that was written into the slot returned by queue_reserve()
+ * to the back of the queue.
+ *
+ * @warning This function returns E_BUFF_OVERFLOW if the queue is full.
+ *
+ * @param [in] queue the queue that the slot will be added to
+ *
+ * @retval E_NO_ERROR if no error occurred and the slot was added.
+ * @retval E_BUFF_OVERFLOW if the queue is full
+ *
+ */
+uint8_t queue_commit(queue_t *queue);
+
+/**
+ * @name    Peek at an Item
+ * @brief   Gets the first element in the queue without removing it.
+ * @ingroup queue
+ *
+ * Returns the slot at the front of the queue so that the element can be read
+ * in place. The element stays in the queue until queue_release() is called
+ * and the slot is kept from the producer until then.
+ *
+ * @param [in] queue the queue that will be looked at
+ *
+ * @returns a pointer to the first element or 0 if the queue is empty
+ *
+ */
+uint8_t *queue_peek(queue_t *queue);
+
+/**
+ * @name    Release an Item
+ * @brief   Removes the first element in the queue.
+ * @ingroup queue
+ *
+ * Removes the element that was returned by queue_peek() from the queue. The
+ * slot can then be reused by the producer. This is done even if the element
+ * is no longer in the queue.
+ *
+ * The queue may have been cleared from an ISR while the element was being read
+ * and a new element may already be at the front. The element is only removed
+ * if the front of the queue is still the slot that was peeked at so the new
+ * element is never thrown away unread.
+ *
+ * @warning This function returns E_EMPTY if the queue is empty.
+ *
+ * @param [in] queue the queue that the element will be removed from
+ * @param [in] slot the slot that queue_peek() returned
+ *
+ * @retval E_NO_ERROR if no error occurred and the item was removed.
+ * @retval E_EMPTY if the queue is empty or the slot is no longer at the front
+ *
+ */
+uint8_t queue_release(queue_t *queue, const uint8_t *slot);
+
 /**
  * @name    Clears the queue
  * @brief   Removes all data from the queue
@@ -95,6 +207,12 @@ uint8_t queue_dequeue(queue_t *queue, uint8_t *data);
  * Removes all data from the queue and sets the queue size to
  * 0.
  *
+ * @note The tail is moved up to the head so an element that is being read in
+ * place after queue_peek() is no longer part of the queue. Its slot is still
+ * kept from the producer until queue_release() is called. Pass the slot to
+ * queue_release() so that it does not remove an element that was added after
+ * the clear.
+ *
  * @param [in] queue the queue that will be cleared of all its data.
  *
  * @retval E_NO_ERROR if no error occurred and the queue was successfully cleared.
@@ -0,0 +1,183 @@
+/**
+ * @file   ring.h
+ * @brief  Defines the indices of a ring buffer with a power of two capacity.
+ *
+ * A ring_t only holds the head and the tail of a ring buffer. The storage is
+ * owned by the user of the ring so the same code works for any element type.
+ * The head and the tail are free running counters. The number of elements in
+ * the ring is head - tail and the slot of a counter is found by masking it with
+ * capacity - 1. This is why the capacity must be a power of two. Masking is a
+ * single instruction on the AVR while % is a call to the software division
+ * routine when the capacity is not known at compile time. Since the counters
+ * never need to be wrapped every slot of the buffer can be used.
+ *
+ * Pass the capacity as a #define of the user of the ring. The functions are
+ * inline so capacity - 1 then folds into the mask at compile time instead of
+ * being loaded from RAM on every access.
+ *
+ * Only the producer writes the head and only the consumer writes the tail. Each
+ * counter is a single byte so the producer and the consumer can run in different
+ * contexts (one in an ISR and one in the main loop) without disabling interrupts.
+ * The producer must write the element into its slot before calling ring_push().
+ *
+ * @warning The capacity must be a power of two and no larger than 128.
+ */
+#ifndef RING_H_
+#define RING_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+
+/**
+ * Evaluates to non zero if the capacity can be used for a ring
+ */
+#define RING_VALID_CAPACITY(capacity) \
+	((capacity) != 0 && (capacity) <= 128 && ((capacity) & ((capacity) - 1)) == 0)
+
+/**
+ * The indices of a ring buffer
+ */
+typedef struct
+{
+	volatile uint8_t head; /**< the number of elements that have been added */
+	volatile uint8_t tail; /**< the number of elements that have been removed */
+} ring_t;
+
+/**
+ * @name    Initialize the Ring
+ * @brief   Empties the ring.
+ * @ingroup ring
+ *
+ * @param [in] ring the ring that will be initialized
+ */
+static inline void ring_init(ring_t *ring)
+{
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+/**
+ * @name    Ring Count
+ * @brief   Gets the number of elements in the ring.
+ * @ingroup ring
+ *
+ * @param [in] ring the ring that will be counted
+ *
+ * @returns the number of elements in the ring
+ */
+static inline uint8_t ring_count(const ring_t *ring)
+{
+	return (uint8_t) (ring->head - ring->tail);
+}
+
+/**
+ * @name    Ring Full
+ * @brief   Sees if the ring is full.
+ * @ingroup ring
+ *
+ * @param [in] ring the ring that will be checked
+ * @param [in] capacity the number of slots in the ring
+ *
+ * @returns non zero if the ring is full
+ */
+static inline uint8_t ring_full(const ring_t *ring, uint8_t capacity)
+{
+	return ring_count(ring) >= capacity;
+}
+
+/**
+ * @name    Ring Empty
+ * @brief   Sees if the ring is empty.
+ * @ingroup ring
+ *
+ * @param [in] ring the ring that will be checked
+ *
+ * @returns non zero if the ring is empty
+ */
+static inline uint8_t ring_empty(const ring_t *ring)
+{
+	return ring->head == ring->tail;
+}
+
+/**
+ * @name    Ring Head Slot
+ * @brief   Gets the slot where the next element will be added.
+ * @ingroup ring
+ *
+ * @param [in] ring the ring that will be looked at
+ * @param [in] capacity the number of slots in the ring
+ *
+ * @returns the index of the slot
+ */
+static inline uint8_t ring_head(const ring_t *ring, uint8_t capacity)
+{
+	return ring->head & (capacity - 1);
+}
+
+/**
+ * @name    Ring Tail Slot
+ * @brief   Gets the slot of the first element in the ring.
+ * @ingroup ring
+ *
+ * @param [in] ring the ring that will be looked at
+ * @param [in] capacity the number of slots in the ring
+ *
+ * @returns the index of the slot
+ */
+static inline uint8_t ring_tail(const ring_t *ring, uint8_t capacity)
+{
+	return ring->tail & (capacity - 1);
+}
+
+/**
+ * @name    Ring Push
+ * @brief   Adds the element in the head slot to the ring.
+ * @ingroup ring
+ *
+ * @warning The caller must make sure that the ring is not full.
+ *
+ * @param [in] ring the ring the element will be added to
+ */
+static inline void ring_push(ring_t *ring)
+{
+	ring->head++;
+}
+
+/**
+ * @name    Ring Push Many
+ * @brief   Adds the elements in the count slots from the head slot on to the ring.
+ * @ingroup ring
+ *
+ * @warning The caller must make sure that the ring has room for count elements.
+ *
+ * @param [in] ring the ring the elements will be added to
+ * @param [in] count the number of elements
+ */
+static inline void ring_push_many(ring_t *ring, uint8_t count)
+{
+	ring->head += count;
+}
+
+/**
+ * @name    Ring Pop
+ * @brief   Removes the element in the tail slot from the ring.
+ * @ingroup ring
+ *
+ * @warning The caller must make sure that the ring is not empty.
+ *
+ * @param [in] ring the ring the element will be removed from
+ */
+static inline void ring_pop(ring_t *ring)
+{
+	ring->tail++;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RING_H_ */
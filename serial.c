@@ -1,38 +1,37 @@
-#ifndef BAUD_TOL
-#define BAUD_TOL 2
-#endif
-
 #include <inttypes.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
 #include "serial.h"
 #include "error.h"
+#include "ring.h"
+
+#if !RING_VALID_CAPACITY(USART_RX_BUFFER_SIZE) || !RING_VALID_CAPACITY(USART_TX_BUFFER_SIZE)
+#error "The serial buffer sizes must be a power of two no larger than 128"
+#endif
 
 typedef struct {
 	uint8_t buffer[USART_RX_BUFFER_SIZE];
-	volatile uint8_t head;
-	volatile uint8_t tail;
+	ring_t ring;
 } rx_buffer;
 
 typedef struct {
 	uint8_t buffer[USART_TX_BUFFER_SIZE];
-	volatile uint8_t head;
-	volatile uint8_t tail;
+	ring_t ring;
 } tx_buffer;
 
 tx_buffer tx_buff;
 rx_buffer rx_buff;
 
+serial_stats_t serial_stats;
+
 static uint8_t tx_store_byte(uint8_t byte)
 {
-	uint8_t head = (uint8_t) ((tx_buff.head + 1) % USART_TX_BUFFER_SIZE);
-
 	// Make sure that we have space
-	if (head != tx_buff.tail)
+	if (!ring_full(&tx_buff.ring, USART_TX_BUFFER_SIZE))
 	{
-		tx_buff.buffer[tx_buff.head] = byte;
-		tx_buff.head = head;
+		tx_buff.buffer[ring_head(&tx_buff.ring, USART_TX_BUFFER_SIZE)] = byte;
+		ring_push(&tx_buff.ring);
 
 		return E_NO_ERROR;
 	}
@@ -42,12 +41,10 @@ static uint8_t tx_store_byte(uint8_t byte)
 
 static uint8_t tx_read_byte(uint8_t *data_out)
 {
-	if (tx_buff.head != tx_buff.tail)
+	if (!ring_empty(&tx_buff.ring))
 	{
-		uint8_t data = tx_buff.buffer[tx_buff.tail];
-		tx_buff.tail = (uint8_t) ((tx_buff.tail + 1) % USART_TX_BUFFER_SIZE);
-
-		*data_out = data;
+		*data_out = tx_buff.buffer[ring_tail(&tx_buff.ring, USART_TX_BUFFER_SIZE)];
+		ring_pop(&tx_buff.ring);
 
 		return E_NO_ERROR;
 	}
@@ -57,13 +54,11 @@ static uint8_t tx_read_byte(uint8_t *data_out)
 
 static uint8_t rx_store_byte(uint8_t byte)
 {
-	uint8_t head = (uint8_t) ((rx_buff.head + 1) % USART_RX_BUFFER_SIZE);
-
 	// Make sure that we have space
-	if (head != rx_buff.tail)
+	if (!ring_full(&rx_buff.ring, USART_RX_BUFFER_SIZE))
 	{
-		rx_buff.buffer[rx_buff.head] = byte;
-		rx_buff.head = head;
+		rx_buff.buffer[ring_head(&rx_buff.ring, USART_RX_BUFFER_SIZE)] = byte;
+		ring_push(&rx_buff.ring);
 
 		return E_NO_ERROR;
 	}
@@ -73,31 +68,81 @@ static uint8_t rx_store_byte(uint8_t byte)
 
 static uint8_t rx_read_byte(uint8_t *data_out)
 {
-	if (rx_buff.head != rx_buff.tail)
+	if (!ring_empty(&rx_buff.ring))
 	{
-		uint8_t data = rx_buff.buffer[rx_buff.tail];
-		rx_buff.tail = (uint8_t) ((rx_buff.tail + 1) % USART_RX_BUFFER_SIZE);
+		*data_out = rx_buff.buffer[ring_tail(&rx_buff.ring, USART_RX_BUFFER_SIZE)];
+		ring_pop(&rx_buff.ring);
 
-		*data_out = data;
 		return E_NO_ERROR;
 	}
 
 	return E_EMPTY;
 }
 
+/**
+ * The baud rate the serial connection is running at
+ */
+static unsigned long current_baud = 0;
+
+/**
+ * Called with every received byte instead of storing it in the rx queue
+ */
+static void (*rx_function)(uint8_t data) = 0;
+
+/**
+ * Set once a byte has been written so that serial_flush() knows that the
+ * transmit complete flag will be set
+ */
+static volatile uint8_t tx_written = 0;
+
+/**
+ * Finds the UBRR value that comes closest to the baud rate. Normal speed is
+ * tried first and double speed is only used if it is closer. Returns the
+ * error in tenths of a percent.
+ */
+static uint16_t serial_ubrr(unsigned long baud, uint16_t *ubrr_out, uint8_t *use2x_out)
+{
+	uint16_t best_error = 0xFFFF;
+
+	// Page 173 of documentation
+	for (uint8_t use2x = 0; use2x < 2; use2x++)
+	{
+		unsigned long divisor = use2x ? 8UL : 16UL;
+		unsigned long ubrr = (F_CPU + (divisor / 2) * baud) / (divisor * baud);
+
+		// The rate is too fast or too slow for this mode
+		if (ubrr == 0 || ubrr > 4096)
+		{
+			continue;
+		}
+
+		unsigned long actual = F_CPU / (divisor * ubrr);
+		unsigned long diff = actual > baud ? actual - baud : baud - actual;
+		uint16_t error = (uint16_t) ((diff * 1000UL + baud / 2) / baud);
+
+		if (error < best_error)
+		{
+			best_error = error;
+			*ubrr_out = (uint16_t) (ubrr - 1);
+			*use2x_out = use2x;
+		}
+	}
+
+	return best_error;
+}
+
 void serial_begin(unsigned long baud)
 {
-	rx_buff.head = rx_buff.tail = 0;
-	tx_buff.head = tx_buff.tail = 0;
+	uint16_t ubbr = 0;
+	uint8_t use2x = 0;
 
-	// Page 179 of documentation
-    uint8_t use2x = 0;
-    uint16_t ubbr = (F_CPU + 8UL * baud) / (16UL * baud) - 1UL;
-    if ((100 * (F_CPU)) > (16 * (ubbr + 1) * (100 * ubbr + ubbr * BAUD_TOL)))
-    {
-        use2x = 1;
-        ubbr = (F_CPU + 4UL * baud) / (8UL * baud) - 1UL;
-    }
+	serial_ubrr(baud, &ubbr, &use2x);
+
+	ring_init(&rx_buff.ring);
+	ring_init(&tx_buff.ring);
+
+	current_baud = baud;
+	tx_written = 0;
 
 	// Set the upper and lower bits of the
 	// baud rate
@@ -123,6 +168,41 @@ void serial_begin(unsigned long baud)
 	UCSR0B |= (1 << RXCIE0);
 }
 
+unsigned long serial_baud()
+{
+	return current_baud;
+}
+
+uint16_t serial_baud_error(unsigned long baud)
+{
+	uint16_t ubrr;
+	uint8_t use2x;
+
+	return serial_ubrr(baud, &ubrr, &use2x);
+}
+
+uint8_t serial_idle()
+{
+	// Nothing was ever sent so the transmit complete flag will never be set
+	if (!tx_written)
+	{
+		return 1;
+	}
+
+	// The buffer has drained and the last byte has left the shift register
+	return ring_empty(&tx_buff.ring) && (UCSR0A & (1 << TXC0));
+}
+
+void serial_flush()
+{
+	while (!serial_idle());
+}
+
+void serial_on_receive(void (*function)(uint8_t data))
+{
+	rx_function = function;
+}
+
 uint8_t serial_read_byte(uint8_t *data_out)
 {
 	uint8_t data, status;
@@ -139,7 +219,7 @@ uint8_t serial_read_byte(uint8_t *data_out)
 
 uint8_t serial_available()
 {
-	return (uint8_t) (USART_RX_BUFFER_SIZE + rx_buff.head - rx_buff.tail) % USART_RX_BUFFER_SIZE;
+	return ring_count(&rx_buff.ring);
 }
 
 uint8_t serial_write_byte(uint8_t data)
@@ -151,6 +231,8 @@ uint8_t serial_write_byte(uint8_t data)
 
 	if (status == E_NO_ERROR)
 	{
+		tx_written = 1;
+
 		// Enable Data Register Empty interrupt
 		UCSR0B |= (1 << UDRIE0);
 	}
@@ -158,19 +240,78 @@ uint8_t serial_write_byte(uint8_t data)
 	return status;
 }
 
+uint8_t serial_free()
+{
+	return USART_TX_BUFFER_SIZE - ring_count(&tx_buff.ring);
+}
+
+uint8_t serial_reserve(serial_frame_t *frame, uint8_t size)
+{
+	// It would never fit
+	if (size > USART_TX_BUFFER_SIZE)
+	{
+		serial_stats.dropped++;
+		return E_BUFF_OVERFLOW;
+	}
+
+	if (serial_free() < size)
+	{
+		// Only the tx interrupt can make room
+		if (!(SREG & (1 << SREG_I)))
+		{
+			serial_stats.dropped++;
+			return E_BUFF_OVERFLOW;
+		}
+
+		serial_stats.delayed++;
+
+		while (serial_free() < size);
+	}
+
+	// The frame starts at the head and the tx interrupt stops before it
+	frame->buffer = tx_buff.buffer;
+	frame->start = tx_buff.ring.head;
+	frame->size = size;
+
+	return E_NO_ERROR;
+}
+
+void serial_frame_fill(serial_frame_t *frame, uint8_t index, uint8_t count, uint8_t data)
+{
+	for (uint8_t i = 0; i < count; i++)
+	{
+		serial_frame_put(frame, index + i, data);
+	}
+}
+
+void serial_commit(serial_frame_t *frame)
+{
+	// Hand the whole frame to the tx interrupt at once
+	ring_push_many(&tx_buff.ring, frame->size);
+
+	tx_written = 1;
+
+	// Enable Data Register Empty interrupt
+	UCSR0B |= (1 << UDRIE0);
+}
+
 uint8_t serial_write_chunk(void *data, uint8_t size)
 {
-	uint8_t status;
 	uint8_t *ptr = (uint8_t *) data;
+	serial_frame_t frame;
+
+	if (serial_reserve(&frame, size) != E_NO_ERROR)
+	{
+		return E_BUFF_OVERFLOW;
+	}
 
 	for (uint8_t i = 0; i < size; i++)
 	{
-		if ((status = serial_write_byte(*(ptr + i))) != E_NO_ERROR)
-		{
-			return status;
-		}
+		serial_frame_put(&frame, i, ptr[i]);
 	}
 
+	serial_commit(&frame);
+
 	return E_NO_ERROR;
 }
 
@@ -182,7 +323,14 @@ ISR (USART_RX_vect)
 	// Get the data
 	uint8_t data = UDR0;
 
-	rx_store_byte(data);
+	if (rx_function)
+	{
+		rx_function(data);
+	}
+	else
+	{
+		rx_store_byte(data);
+	}
 }
 
 /*
@@ -192,7 +340,7 @@ ISR (USART_UDRE_vect)
 {
 	// We don't have any more data
 	// so disable the interrupt
-	if (tx_buff.head == tx_buff.tail)
+	if (ring_empty(&tx_buff.ring))
 	{
 		UCSR0B &= ~(1 << UDRIE0);
 	}
@@ -203,5 +351,9 @@ ISR (USART_UDRE_vect)
 		tx_read_byte(&data);
 		UDR0 = data;
 
+		// Clear the transmit complete flag so serial_flush() can wait on it.
+		// Writing a one clears it and U2X0 must be kept.
+		UCSR0A = (UCSR0A & (1 << U2X0)) | (1 << TXC0);
+
 	}
 }
@@ -20,21 +20,46 @@ extern "C"
 #include "error.h"
 
 /**
- * The size of the receive buffer
+ * The size of the receive buffer. Must be a power of two.
  */
 #define USART_RX_BUFFER_SIZE 64
 
 /**
- * The size of the transmit buffer
+ * The size of the transmit buffer. Must be a power of two.
  */
 #define USART_TX_BUFFER_SIZE 64
 
+/**
+ * A frame that has been reserved in the tx queue but not sent yet
+ */
+typedef struct
+{
+	uint8_t *buffer; /**< the tx buffer that the frame is in */
+	uint8_t start; /**< the position of the first byte of the frame in the tx buffer */
+	uint8_t size; /**< the number of bytes that were reserved */
+} serial_frame_t;
+
+/**
+ * The counters of the transmitter
+ */
+typedef struct
+{
+	uint16_t delayed; /**< the number of frames that had to wait for room in the tx buffer */
+	uint16_t dropped; /**< the number of frames that were thrown away whole */
+} serial_stats_t;
+
+/**
+ * The counters of the transmitter
+ */
+extern serial_stats_t serial_stats;
+
 /**
  * @name    Serial Begin
  * @brief	Starts and configures the serial chip
  * @ingroup serial
  *
- * This function begins a serial connection.
+ * This function begins a serial connection. It can be called again to change
+ * the baud rate. Any bytes in the rx and tx queues are thrown away.
  *
  * @note This function must be called before calling the other serial functions.
  *
@@ -43,6 +68,78 @@ extern "C"
  */
 void serial_begin(unsigned long baud);
 
+/**
+ * The largest baud rate error (in tenths of a percent) that serial_baud_error()
+ * can return for a rate to be usable. 115200 baud is 2.1% off at 16 MHz.
+ */
+#define BAUD_MAX_ERROR 25
+
+/**
+ * @name    Serial Baud
+ * @brief	Gets the baud rate of the serial connection
+ * @ingroup serial
+ *
+ * @returns the baud rate passed to the last call of serial_begin()
+ */
+unsigned long serial_baud();
+
+/**
+ * @name    Serial Baud Error
+ * @brief	Calculates how close the clock can get to a baud rate
+ * @ingroup serial
+ *
+ * This function finds the closest rate that the USART can generate from F_CPU
+ * for the given baud rate. Rates with an error larger than BAUD_MAX_ERROR should
+ * not be used since the receiver will not be able to sample the bits reliably.
+ *
+ * @param [in] baud the baud rate that will be checked
+ *
+ * @returns the error in tenths of a percent or 0xFFFF if the rate can't be
+ * generated at all
+ */
+uint16_t serial_baud_error(unsigned long baud);
+
+/**
+ * @name    Serial Flush
+ * @brief	Waits for all of the queued bytes to be sent
+ * @ingroup serial
+ *
+ * This function blocks until the tx queue is empty and the last byte has left
+ * the USART. Call it before changing the baud rate. Use serial_idle() to wait
+ * without blocking.
+ *
+ * @warning Do not call this function with interrupts disabled. The tx queue is
+ * drained by the Data Register Empty interrupt.
+ */
+void serial_flush();
+
+/**
+ * @name    Serial On Receive
+ * @brief	Hands every received byte to a function instead of the rx queue
+ * @ingroup serial
+ *
+ * The function is called from the receive interrupt as soon as each byte
+ * arrives so it must be short. While a function is set the rx queue stays
+ * empty and serial_read_byte() has nothing to read.
+ *
+ * @param [in] function the function that is called with each byte or 0 to
+ * go back to the rx queue
+ */
+void serial_on_receive(void (*function)(uint8_t data));
+
+/**
+ * @name    Serial Idle
+ * @brief	Sees if every queued byte has been sent
+ * @ingroup serial
+ *
+ * This is the check that serial_flush() waits on. A task can wait on it
+ * instead of blocking.
+ *
+ * @returns non zero if the tx queue is empty and the last byte has left the
+ * USART
+ */
+uint8_t serial_idle();
+
 /**
  * @name    Serial Read Byte
  * @brief	Reads the next byte in the serial RX queue
@@ -91,17 +188,28 @@ uint8_t serial_available();
  */
 uint8_t serial_write_byte(uint8_t data);
 
+/**
+ * @name    Serial Free
+ * @brief	Sees how many bytes can be added to the tx queue
+ * @ingroup serial
+ *
+ * @returns the number of free bytes in the tx queue
+ */
+uint8_t serial_free();
+
 /**
  * @name    Serial Write Chunk
- * @brief	Enqueues an array of bytes to the tx queue
+ * @brief	Enqueues an array of bytes to the tx queue as one frame
  * @ingroup serial
  *
  * This function enqueues the array of bytes to the tx buffer. Once all the bytes
- * before it are sent the inputed array of bytes will then be sent.
+ * before it are sent the inputed array of bytes will then be sent. The array is
+ * added whole or not at all so a frame is never torn on the wire.
  *
- * @warning Returns E_BUFF_OVERFLOW if the byte array would cause the tx buffer
- * to overflow. HOWEVER THE BYTES IN THE ARRAY BEFORE THE ARRAY WOULD HAVE OVERFLOWED
- * ARE STILL ADDED TO THE BUFFER.
+ * If there is not enough room the function waits for the tx interrupt to send
+ * enough bytes and counts the frame in serial_stats.delayed. If interrupts are
+ * disabled nothing can make room so the frame is thrown away instead and counted
+ * in serial_stats.dropped.
  *
  * @warning Providing an incorrect parameter of size will cause a buffer overflow
  * that the serial functions can not detect.
@@ -110,11 +218,70 @@ uint8_t serial_write_byte(uint8_t data);
  * @param [in] size the size of the array
  *
  * @retval E_NO_ERROR no error occurred
- * @retval E_BUFF_OVERFLOW the tx buffer is full and adding the byte would overflow
- * it
+ * @retval E_BUFF_OVERFLOW the array was thrown away because it is larger than
+ * the tx buffer or there was no room and interrupts are disabled
  */
 uint8_t serial_write_chunk(void *data, uint8_t size);
 
+/**
+ * @name    Serial Reserve
+ * @brief	Reserves room for a frame in the tx queue
+ * @ingroup serial
+ *
+ * This function reserves size bytes at the end of the tx queue so that a frame
+ * can be built in place with serial_frame_put() instead of in a buffer of its
+ * own. The bytes are not sent until serial_commit() is called. Room is waited
+ * for and counted the same way as serial_write_chunk().
+ *
+ * @warning Only one frame can be reserved at a time and nothing else can be
+ * written until it is committed. Only call this function from the main loop.
+ *
+ * @param [out] frame the frame that will be reserved
+ * @param [in] size the size of the frame in bytes
+ *
+ * @retval E_NO_ERROR no error occurred and the frame was reserved
+ * @retval E_BUFF_OVERFLOW the frame was thrown away because it is larger than
+ * the tx buffer or there was no room and interrupts are disabled
+ */
+uint8_t serial_reserve(serial_frame_t *frame, uint8_t size);
+
+/**
+ * @name    Serial Frame Put
+ * @brief	Writes a byte of a reserved frame
+ * @ingroup serial
+ *
+ * @param [in] frame the frame that was reserved with serial_reserve()
+ * @param [in] index the index of the byte in the frame
+ * @param [in] data the byte that will be written
+ */
+static inline void serial_frame_put(serial_frame_t *frame, uint8_t index, uint8_t data)
+{
+	frame->buffer[(uint8_t) (frame->start + index) & (USART_TX_BUFFER_SIZE - 1)] = data;
+}
+
+/**
+ * @name    Serial Frame Fill
+ * @brief	Sets a run of bytes of a reserved frame to the same value
+ * @ingroup serial
+ *
+ * @param [in] frame the frame that was reserved with serial_reserve()
+ * @param [in] index the index of the first byte in the frame
+ * @param [in] count the number of bytes
+ * @param [in] data the value of the bytes
+ */
+void serial_frame_fill(serial_frame_t *frame, uint8_t index, uint8_t count, uint8_t data);
+
+/**
+ * @name    Serial Commit
+ * @brief	Sends a reserved frame
+ * @ingroup serial
+ *
+ * This function adds the whole frame to the tx queue at once so the tx interrupt
+ * never sees half of it.
+ *
+ * @param [in] frame the frame that was reserved with serial_reserve()
+ */
+void serial_commit(serial_frame_t *frame);
 
 #ifdef __cplusplus
 }
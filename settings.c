@@ -0,0 +1,199 @@
+#include "settings.h"
+#include "error.h"
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+/**
+ * A setting in the registry
+ */
+typedef struct
+{
+	void *value; /**< the variable that holds the setting or 0 if not registered */
+	uint8_t type; /**< the type of the variable */
+	uint16_t min; /**< the smallest value the setting may take */
+	uint16_t max; /**< the largest value the setting may take */
+} setting_t;
+
+/**
+ * The record that is saved to the EEPROM. The CRC must be the last field.
+ */
+typedef struct
+{
+	uint16_t sequence; /**< incremented on every save */
+	uint16_t values[SETTING_COUNT]; /**< the value of every setting */
+	uint16_t crc; /**< the CRC16 of the fields above */
+} settings_record_t;
+
+/**
+ * The number of record slots that fit in the EEPROM
+ */
+#define SETTINGS_SLOTS ((E2END + 1) / sizeof(settings_record_t))
+
+/**
+ * Gets the EEPROM address of a record slot
+ */
+#define SETTINGS_SLOT(slot) ((settings_record_t *) ((slot) * sizeof(settings_record_t)))
+
+static setting_t settings[SETTING_COUNT];
+
+/**
+ * The slot that holds the newest record and its sequence number
+ */
+static uint8_t newest_slot = SETTINGS_SLOTS - 1;
+static uint16_t newest_sequence = 0;
+
+static uint16_t settings_crc(const settings_record_t *record);
+
+/**
+ * Gets the CRC16 of a record. The version is folded in so that a record
+ * with an old layout is never loaded.
+ */
+static uint16_t settings_crc(const settings_record_t *record)
+{
+	const uint8_t *bytes = (const uint8_t *) record;
+	uint16_t crc = _crc16_update(0xFFFF, SETTINGS_VERSION);
+
+	for (uint8_t i = 0; i < sizeof(settings_record_t) - sizeof(record->crc); i++)
+	{
+		crc = _crc16_update(crc, bytes[i]);
+	}
+
+	return crc;
+}
+
+void settings_register(uint8_t id, void *value, uint8_t type, uint16_t min, uint16_t max)
+{
+	if (id >= SETTING_COUNT)
+	{
+		return;
+	}
+
+	settings[id].value = value;
+	settings[id].type = type;
+	settings[id].min = min;
+	settings[id].max = max;
+}
+
+uint8_t settings_get(uint8_t id, uint16_t *value_out)
+{
+	if (id >= SETTING_COUNT || settings[id].value == 0)
+	{
+		return E_INV_CALL;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (settings[id].type == SETTING_U8)
+		{
+			*value_out = *(uint8_t *) settings[id].value;
+		}
+		else
+		{
+			*value_out = *(uint16_t *) settings[id].value;
+		}
+	}
+
+	return E_NO_ERROR;
+}
+
+uint8_t settings_set(uint8_t id, uint16_t value)
+{
+	if (id >= SETTING_COUNT || settings[id].value == 0)
+	{
+		return E_INV_CALL;
+	}
+
+	// Keep it in range
+	if (value < settings[id].min || value > settings[id].max)
+	{
+		return E_INV_CALL;
+	}
+
+	// The variable may be read from an ISR
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if (settings[id].type == SETTING_U8)
+		{
+			*(uint8_t *) settings[id].value = (uint8_t) value;
+		}
+		else
+		{
+			*(uint16_t *) settings[id].value = value;
+		}
+	}
+
+	return E_NO_ERROR;
+}
+
+void settings_save()
+{
+	settings_record_t record;
+
+	record.sequence = newest_sequence + 1;
+
+	for (uint8_t i = 0; i < SETTING_COUNT; i++)
+	{
+		record.values[i] = 0;
+		settings_get(i, &record.values[i]);
+	}
+
+	record.crc = settings_crc(&record);
+
+	// Go to the next slot so every slot wears the same
+	uint8_t slot = newest_slot + 1;
+
+	if (slot >= SETTINGS_SLOTS)
+	{
+		slot = 0;
+	}
+
+	// The CRC is last so a cut short write is never loaded
+	eeprom_update_block(&record, SETTINGS_SLOT(slot), sizeof(record));
+
+	newest_slot = slot;
+	newest_sequence = record.sequence;
+}
+
+uint8_t settings_load()
+{
+	settings_record_t record;
+	settings_record_t newest;
+	uint8_t found = 0;
+
+	// One pass over the slots to find the newest good record
+	for (uint8_t slot = 0; slot < SETTINGS_SLOTS; slot++)
+	{
+		eeprom_read_block(&record, SETTINGS_SLOT(slot), sizeof(record));
+
+		if (record.crc != settings_crc(&record))
+		{
+			continue;
+		}
+
+		// The sequence number wraps so compare the difference
+		if (!found || (int16_t) (record.sequence - newest.sequence) > 0)
+		{
+			newest = record;
+			newest_slot = slot;
+			found = 1;
+		}
+	}
+
+	if (!found)
+	{
+		return E_EMPTY;
+	}
+
+	newest_sequence = newest.sequence;
+
+	for (uint8_t i = 0; i < SETTING_COUNT; i++)
+	{
+		// Out of range values are skipped by settings_set()
+		settings_set(i, newest.values[i]);
+	}
+
+	return E_NO_ERROR;
+}
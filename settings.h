@@ -0,0 +1,185 @@
+/**
+ * @file   settings.h
+ * @brief  Defines a registry of tunable settings that are kept in the EEPROM.
+ *
+ * Every setting has an id that is defined in this file. At boot each setting
+ * is registered with a pointer to the variable that holds it, its type and the
+ * range of values it may take. The control device reads and writes settings
+ * by id with the CMD_GET_PARAM and CMD_SET_PARAM commands.
+ *
+ * The settings are saved to the EEPROM as a record that holds the value of
+ * every setting, a sequence number and a CRC16. The EEPROM is split into as
+ * many record slots as fit and each save goes into the slot after the newest
+ * one so the writes are spread over the whole EEPROM. The CRC is written last
+ * so a save that is cut short is ignored. At boot every slot is read once and
+ * the newest record with a good CRC is loaded.
+ */
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+
+// --------------------------------------------------------------------
+// Setting Ids
+// --------------------------------------------------------------------
+
+/**
+ * The delay between steps at a standstill (in microseconds)
+ */
+#define SETTING_START_DELAY 0x00
+
+/**
+ * The delay between steps at cruise speed (in microseconds)
+ */
+#define SETTING_CRUISE_DELAY 0x01
+
+/**
+ * The acceleration of the drink plate (in steps per second per second)
+ */
+#define SETTING_ACCEL 0x02
+
+/**
+ * The deceleration of the drink plate (in steps per second per second)
+ */
+#define SETTING_DECEL 0x03
+
+/**
+ * The size of a shot (in milliliters)
+ */
+#define SETTING_SHOT 0x04
+
+/**
+ * The time it takes to lower the pouring actuator (in milliseconds)
+ */
+#define SETTING_POUR_DOWN_TIME 0x05
+
+/**
+ * The most messages that the command queue will hold
+ */
+#define SETTING_QUEUE_LIMIT 0x06
+
+/**
+ * The distance from home to a location (in full steps). There is one setting
+ * for each of the 13 locations.
+ */
+#define SETTING_OFFSET(location) (0x07 + (location))
+
+/**
+ * The time into the last down stroke of a pour after which the plate may
+ * move (in milliseconds)
+ */
+#define SETTING_POUR_CLEARANCE 0x14
+
+/**
+ * The time it takes to raise the pouring actuator at a location (in
+ * milliseconds). There is one setting for each of the 13 locations.
+ */
+#define SETTING_UP_TIME(location) (0x15 + (location))
+
+/**
+ * The time the actuator is held up for each milliliter at a location (in
+ * milliseconds). There is one setting for each of the 13 locations.
+ */
+#define SETTING_FLOW(location) (0x22 + (location))
+
+/**
+ * The number of settings
+ */
+#define SETTING_COUNT 47
+
+// --------------------------------------------------------------------
+// Setting Types
+// --------------------------------------------------------------------
+
+/**
+ * The setting is held in a uint8_t
+ */
+#define SETTING_U8 0x01
+
+/**
+ * The setting is held in a uint16_t
+ */
+#define SETTING_U16 0x02
+
+/**
+ * Changes whenever the layout of the saved record changes so that an old
+ * record is not loaded into the wrong settings
+ */
+#define SETTINGS_VERSION 0x03
+
+/**
+ * @name    Register a Setting
+ * @brief   Lets the registry know where a setting is held.
+ * @ingroup settings
+ *
+ * @param [in] id the id of the setting
+ * @param [in] value the variable that holds the setting
+ * @param [in] type either SETTING_U8 or SETTING_U16
+ * @param [in] min the smallest value the setting may take
+ * @param [in] max the largest value the setting may take
+ */
+void settings_register(uint8_t id, void *value, uint8_t type, uint16_t min, uint16_t max);
+
+/**
+ * @name    Get a Setting
+ * @brief   Reads the value of a setting.
+ * @ingroup settings
+ *
+ * @param [in] id the id of the setting
+ * @param [out] value_out the value of the setting
+ *
+ * @retval E_NO_ERROR no error occurred and the value was read
+ * @retval E_INV_CALL the setting has not been registered
+ */
+uint8_t settings_get(uint8_t id, uint16_t *value_out);
+
+/**
+ * @name    Set a Setting
+ * @brief   Changes the value of a setting.
+ * @ingroup settings
+ *
+ * The new value is used right away. Call settings_save() to keep it.
+ *
+ * @param [in] id the id of the setting
+ * @param [in] value the new value of the setting
+ *
+ * @retval E_NO_ERROR no error occurred and the value was changed
+ * @retval E_INV_CALL the setting has not been registered or the value is out
+ * of range
+ */
+uint8_t settings_set(uint8_t id, uint16_t value);
+
+/**
+ * @name    Save the Settings
+ * @brief   Writes every setting to the next record slot of the EEPROM.
+ * @ingroup settings
+ *
+ * @note This function blocks while the EEPROM is written which takes a few
+ * milliseconds per byte. It should not be called from an ISR.
+ */
+void settings_save();
+
+/**
+ * @name    Load the Settings
+ * @brief   Loads the newest saved record from the EEPROM.
+ * @ingroup settings
+ *
+ * This function must be called after every setting has been registered. A
+ * saved value that is out of range is skipped and the setting keeps the
+ * value it had.
+ *
+ * @retval E_NO_ERROR no error occurred and the settings were loaded
+ * @retval E_EMPTY no record with a good CRC was found
+ */
+uint8_t settings_load();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SETTINGS_H_ */
@@ -1,93 +1,238 @@
 #include "stepper.h"
 #include "Arduino.h"
+#include "error.h"
+#include "pins.h"
+#include "idle.h"
 
+#include <util/atomic.h>
 
-void stepper_init(stepper_t *stepper, uint8_t pin0, uint8_t pin1, uint8_t pin2, uint8_t pin3)
+static void stepper_advance(stepper_t *stepper, uint8_t direction);
+static void stepper_write(uint8_t coils);
+static void stepper_timer_load(uint16_t delay);
+
+/**
+ * The full step sequence. Bit 0 is the first control line.
+ */
+static const uint8_t full_step[4] = {0x05, 0x06, 0x0A, 0x09};
+
+/**
+ * The half step sequence. Every other phase only energizes one coil.
+ */
+static const uint8_t half_step[8] = {0x05, 0x04, 0x06, 0x02, 0x0A, 0x08, 0x09, 0x01};
+
+/**
+ * The stepper that the Timer1 interrupt is driving
+ */
+static stepper_t *volatile active = 0;
+
+void stepper_init(stepper_t *stepper, uint8_t mode)
 {
-	stepper->pin0 = pin0;
-	stepper->pin1 = pin1;
-	stepper->pin2 = pin2;
-	stepper->pin3 = pin3;
 	stepper->step = 0;
 
-	stepper->delay = DELAY;
+	if (mode == STEPPER_HALF_STEP)
+	{
+		stepper->mode = STEPPER_HALF_STEP;
+		stepper->sequence = half_step;
+		stepper->length = sizeof(half_step);
+	}
+	else
+	{
+		stepper->mode = STEPPER_FULL_STEP;
+		stepper->sequence = full_step;
+		stepper->length = sizeof(full_step);
+	}
+
+	motion_config_init(&stepper->motion);
 
-	pinMode(stepper->pin0, OUTPUT);
-	pinMode(stepper->pin1, OUTPUT);
-	pinMode(stepper->pin2, OUTPUT);
-	pinMode(stepper->pin3, OUTPUT);
+	stepper->direction = FORWARD;
+	stepper->steps = 0;
+	stepper->remaining = 0;
+	stepper->running = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		STEPPER_DDR |= STEPPER_MASK;
+	}
+}
+
+/**
+ * Writes the state of all four control lines in one port write. Bit 0 of
+ * coils is the first control line.
+ */
+static void stepper_write(uint8_t coils)
+{
+	// The toggle driver may share the port so this must not be interrupted
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		STEPPER_PORT = (STEPPER_PORT & ~STEPPER_MASK) | ((coils << STEPPER_SHIFT) & STEPPER_MASK);
+	}
 }
 
-void stepper_step(stepper_t *stepper, uint8_t direction)
+static void stepper_advance(stepper_t *stepper, uint8_t direction)
 {
 	// Calculate the next step
 	if (direction == FORWARD)
 	{
-		if (stepper->step == 3)
+		stepper->step++;
+
+		if (stepper->step == stepper->length)
 		{
 			stepper->step = 0;
 		}
-		else
-		{
-			stepper->step++;
-		}
 	}
 	else
 	{
 		if (stepper->step == 0)
 		{
-			stepper->step = 3;
-		}
-		else
-		{
-			stepper->step--;
+			stepper->step = stepper->length;
 		}
+
+		stepper->step--;
 	}
 
-	// See what step we are on
-	switch (stepper->step)
+	stepper_write(stepper->sequence[stepper->step]);
+}
+
+/**
+ * Loads the delay (in microseconds) until the next step into Timer1
+ */
+static void stepper_timer_load(uint16_t delay)
+{
+	// Every count is 0.5uS so double the delay. Clamp to the 16 bit range.
+	if (delay > 0x7FFF)
 	{
-	case 0:
-		digitalWrite(stepper->pin0, HIGH);
-		digitalWrite(stepper->pin1, LOW);
-		digitalWrite(stepper->pin2, HIGH);
-		digitalWrite(stepper->pin3, LOW);
-		break;
-	case 1:
-		digitalWrite(stepper->pin0, LOW);
-		digitalWrite(stepper->pin1, HIGH);
-		digitalWrite(stepper->pin2, HIGH);
-		digitalWrite(stepper->pin3, LOW);
-		break;
-	case 2:
-		digitalWrite(stepper->pin0, LOW);
-		digitalWrite(stepper->pin1, HIGH);
-		digitalWrite(stepper->pin2, LOW);
-		digitalWrite(stepper->pin3, HIGH);
-		break;
-	case 3:
-		digitalWrite(stepper->pin0, HIGH);
-		digitalWrite(stepper->pin1, LOW);
-		digitalWrite(stepper->pin2, LOW);
-		digitalWrite(stepper->pin3, HIGH);
-		break;
+		delay = 0x7FFF;
 	}
 
-	delay(stepper->delay);
+	OCR1A = (delay << 1) - 1;
 }
 
-void stepper_multi_step(stepper_t *stepper, uint16_t steps, uint8_t direction)
+uint8_t stepper_start(stepper_t *stepper, uint16_t steps, uint16_t planned, uint8_t direction)
 {
-	for (uint16_t i = 0; i < steps; i++)
+	if (stepper->running)
 	{
-		stepper_step(stepper, direction);
+		return E_BUSY;
 	}
+
+	if (steps == 0)
+	{
+		return E_NO_ERROR;
+	}
+
+	motion_plan(&stepper->profile, &stepper->motion, planned);
+
+	stepper->direction = direction;
+	stepper->steps = steps;
+	stepper->remaining = steps;
+	stepper->running = 1;
+	active = stepper;
+
+	// Disable the interrupt while we configure the timer
+	TIMSK1 &= ~(1 << OCIE1A);
+
+	// Set Timer1 to CTC mode (Page 136 of documentation)
+	TCCR1A = 0;
+	TCCR1B = (1 << WGM12);
+
+	// Reset the counter, load the first delay and work out the one after it
+	TCNT1 = 0;
+	stepper_timer_load(motion_next_delay(&stepper->profile));
+	stepper->next = motion_next_delay(&stepper->profile);
+
+	// Clear any pending compare match and enable the interrupt
+	TIFR1 = (1 << OCF1A);
+	TIMSK1 |= (1 << OCIE1A);
+
+	// Start the timer with a prescaler of 8 (0.5uS/count)
+	TCCR1B |= (1 << CS11);
+
+	return E_NO_ERROR;
+}
+
+uint8_t stepper_running(stepper_t *stepper)
+{
+	return stepper->running;
+}
+
+uint16_t stepper_taken(stepper_t *stepper)
+{
+	uint16_t taken;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		taken = stepper->steps - stepper->remaining;
+	}
+
+	return taken;
+}
+
+void stepper_halt(stepper_t *stepper)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		// Stop the clock and disable the interrupt. Remaining is left alone
+		// so that stepper_taken() knows where we stopped.
+		TCCR1B = 0;
+		TIMSK1 &= ~(1 << OCIE1A);
+
+		stepper->running = 0;
+	}
+}
+
+void stepper_multi_step(stepper_t *stepper, uint16_t steps, uint8_t direction)
+{
+	// Wait for the last move to finish
+	while (stepper_running(stepper));
+
+	stepper_start(stepper, steps, steps, direction);
+
+	while (stepper_running(stepper));
 }
 
 void stepper_release(stepper_t *stepper)
 {
-	digitalWrite(stepper->pin0, HIGH);
-	digitalWrite(stepper->pin1, HIGH);
-	digitalWrite(stepper->pin2, HIGH);
-	digitalWrite(stepper->pin3, HIGH);
+	stepper_write(0x0F);
+}
+
+/**
+ * Timer1 compare handler. Takes the next step of the running move.
+ */
+ISR (TIMER1_COMPA_vect)
+{
+	stepper_t *stepper = active;
+
+	if (stepper == 0 || !stepper->running)
+	{
+		return;
+	}
+
+	stepper_advance(stepper, stepper->direction);
+	stepper->remaining--;
+
+	// We are done so stop the timer
+	if (stepper->remaining == 0)
+	{
+		TCCR1B = 0;
+		TIMSK1 &= ~(1 << OCIE1A);
+
+		stepper->running = 0;
+
+		// The main loop has a move to finish
+		idle_notify();
+		return;
+	}
+
+	// The delay was worked out during the last step so this is cheap
+	stepper_timer_load(stepper->next);
+
+	// Working out the next delay can take a square root and a 32 bit division
+	// during a ramp. Mask our own interrupt and let the others in so that the
+	// USART does not overrun while we do it.
+	TIMSK1 &= ~(1 << OCIE1A);
+	sei();
+
+	stepper->next = motion_next_delay(&stepper->profile);
+
+	cli();
+	TIMSK1 |= (1 << OCIE1A);
 }
@@ -7,12 +7,23 @@
  *
  * Defines the a unidirectional stepper motor and the operations that can
  * be performed on it. The stepper motor is connected to the microprocessor
- * via 4 digital output pins that control the motor driver (H-Bridge).
+ * via 4 digital output pins that control the motor driver (H-Bridge). The
+ * pins are defined at compile time in pins.h.
+ *
+ * Moves are run in the background by the Timer1 compare interrupt. A move is
+ * started with stepper_start() which returns right away. The interrupt steps
+ * the motor and reloads the compare register with a delay that was worked out
+ * during the previous step. The delay after that is then worked out with the
+ * compare interrupt masked but global interrupts enabled, so that the square
+ * root and division of a ramp never hold off the USART interrupts. When the
+ * last step is taken the timer is stopped and stepper_running() returns false.
+ * Only one stepper can be driven by the interrupt at a time.
  */
 #ifndef STEPPER_H_
 #define STEPPER_H_
 
 #include "inttypes.h"
+#include "motion.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -20,9 +31,15 @@ extern "C"
 #endif
 
 /**
- * The default delay between steps (in milliseconds)
+ * Full step mode. Four phases per cycle with both coils energized.
+ */
+#define STEPPER_FULL_STEP 1
+
+/**
+ * Half step mode. Eight phases per cycle that alternate between one and two
+ * energized coils. Each step is half of a full step.
  */
-#define DELAY 2
+#define STEPPER_HALF_STEP 2
 
 /**
  * The forward direction
@@ -40,8 +57,16 @@ extern "C"
 typedef struct
 {
 	uint8_t step; /**< the current step sequence the motor is at */
-	uint8_t pin0, pin1, pin2, pin3; /**< the digital output pins connected to the control lines of the motor driver */
-	unsigned long delay; /**< the delay between steps */
+	uint8_t mode; /**< the step mode which is also the number of steps per full step */
+	const uint8_t *sequence; /**< the coil bitmask of each phase of the step sequence */
+	uint8_t length; /**< the number of phases in the step sequence */
+	motion_config_t motion; /**< the speeds and rates used for multi step moves */
+	motion_profile_t profile; /**< the planned move that the interrupt is running */
+	uint8_t direction; /**< the direction of the move that the interrupt is running */
+	uint16_t next; /**< the delay before the next step, worked out ahead of time */
+	uint16_t steps; /**< the number of steps in the move that the interrupt is running */
+	volatile uint16_t remaining; /**< the number of steps left in the move */
+	volatile uint8_t running; /**< true while the interrupt is running a move */
 } stepper_t;
 
 /**
@@ -49,40 +74,88 @@ typedef struct
  * @brief   Sets up the default values for the steper structure.
  * @ingroup stepper
  *
- * Sets up a stepper_t.
+ * Sets up a stepper_t and makes the control lines defined in pins.h
+ * outputs. The mode selects the step sequence that is used. Distances
+ * measured in full steps must be multiplied by the mode.
  *
  * @param [in] stepper the stepper that will be initialized
- * @param [in] pin0 the first digital control line
- * @param [in] pin1 the second digital control line
- * @param [in] pin2 the third digital control line
- * @param [in] pin3 the fourth digital control line
+ * @param [in] mode either STEPPER_FULL_STEP or STEPPER_HALF_STEP
  */
-void stepper_init(stepper_t *stepper, uint8_t pin0, uint8_t pin1, uint8_t pin2, uint8_t pin3);
+void stepper_init(stepper_t *stepper, uint8_t mode);
 
 /**
- * @name    Step the Stepper
- * @brief   Steps the stepper in the given direction.
+ * @name    Start a Move
+ * @brief   Starts stepping the stepper in the background.
  * @ingroup stepper
  *
- * Steps the stepper in the given direction.
+ * Plans a move using the motion field of the stepper and hands it to the
+ * Timer1 interrupt. This function returns right away. Use stepper_running()
+ * to find out when the move has completed.
  *
- * @note This function does take into account the delay field in
- * the stepper_t function.
+ * @note The move is planned for the given number of planned steps. If steps
+ * is larger than planned the remaining steps are taken at the start speed. This
+ * is used when homing so that the plate crawls into the bump sensor.
  *
- * @param [in] stepper the stepper that will be initialized
- * @param [in] pin0 the first digital control line
- * @param [in] pin1 the second digital control line
- * @param [in] pin2 the third digital control line
- * @param [in] pin3 the fourth digital control line
+ * @warning This function returns E_BUSY if a move is already running.
+ *
+ * @param [in] stepper the stepper that will be moved
+ * @param [in] steps the amount of steps the stepper will step
+ * @param [in] planned the amount of steps the acceleration profile covers
+ * @param [in] direction the direction in which stepper will step
+ *
+ * @retval E_NO_ERROR no error occurred and the move was started
+ * @retval E_BUSY a move is already running
+ */
+uint8_t stepper_start(stepper_t *stepper, uint16_t steps, uint16_t planned, uint8_t direction);
+
+/**
+ * @name    Stepper Running
+ * @brief   Sees if the stepper is running a move.
+ * @ingroup stepper
+ *
+ * @param [in] stepper the stepper that will be checked
+ *
+ * @returns non zero if a move is running and zero if the move has completed
  */
-void stepper_step(stepper_t *stepper, uint8_t direction);
+uint8_t stepper_running(stepper_t *stepper);
+
+/**
+ * @name    Stepper Steps Taken
+ * @brief   Gets the number of steps of the last move that have been taken.
+ * @ingroup stepper
+ *
+ * While a move is running this is the progress of the move. Once the move
+ * has completed or has been halted it is the number of steps that were
+ * actually taken.
+ *
+ * @param [in] stepper the stepper that will be checked
+ *
+ * @returns the number of steps taken
+ */
+uint16_t stepper_taken(stepper_t *stepper);
+
+/**
+ * @name    Halt the Stepper
+ * @brief   Stops the move that is running.
+ * @ingroup stepper
+ *
+ * Stops the Timer1 interrupt so that no more steps are taken. The steps that
+ * were taken can still be read with stepper_taken(). This function is safe to
+ * call from an ISR.
+ *
+ * @param [in] stepper the stepper that will be halted
+ */
+void stepper_halt(stepper_t *stepper);
 
 /**
  * @name    Step the Stepper for Multiple Steps
  * @brief   Steps the stepper in the given direction for a number of steps.
  * @ingroup stepper
  *
- * Steps the stepper the given number of steps in the specified direction.
+ * Steps the stepper the given number of steps in the specified direction. The
+ * move accelerates and decelerates using the motion field of the stepper.
+ *
+ * @note This function blocks until the move has completed.
  *
  * @param [in] stepper the stepper that will be initialized
  * @param [in] steps the amount of steps the stepper will step
@@ -0,0 +1,57 @@
+#include "task.h"
+
+void scheduler_init(scheduler_t *scheduler)
+{
+	for (uint8_t i = 0; i < TASK_SLOTS; i++)
+	{
+		scheduler->tasks[i].run = 0;
+	}
+}
+
+uint8_t scheduler_add(scheduler_t *scheduler, uint8_t (*run)(task_t *task), void *data)
+{
+	for (uint8_t i = 0; i < TASK_SLOTS; i++)
+	{
+		task_t *task = &scheduler->tasks[i];
+
+		if (task->run == 0)
+		{
+			task_init(task);
+			task->data = data;
+			task->wake = 0;
+			task->run = run;
+
+			return i;
+		}
+	}
+
+	// No room
+	return TASK_NONE;
+}
+
+uint8_t scheduler_run(scheduler_t *scheduler)
+{
+	uint8_t waiting = 0;
+
+	for (uint8_t i = 0; i < TASK_SLOTS; i++)
+	{
+		task_t *task = &scheduler->tasks[i];
+
+		if (task->run == 0)
+		{
+			continue;
+		}
+
+		if (task->run(task) == TASK_EXITED)
+		{
+			// Free the slot
+			task->run = 0;
+		}
+		else
+		{
+			waiting++;
+		}
+	}
+
+	return waiting;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file   task.h
+ * @brief  Defines cooperative tasks and a scheduler with fixed task slots.
+ *
+ * A task is a function that runs until it has to wait and then returns. The
+ * next time it is run it picks up where it left off. Where it left off is kept
+ * in the task_t as the line number of the wait (a protothread). Since the
+ * function really returns, a task needs no stack of its own and the local
+ * variables of the function do not survive a wait. Keep anything that is
+ * needed after a wait in the structure that the task works on.
+ *
+ * @code
+ * uint8_t blink(task_t *task)
+ * {
+ * 	TASK_BEGIN(task);
+ *
+ * 	while (1)
+ * 	{
+ * 		led_toggle();
+ * 		task->wake = millis();
+ * 		TASK_WAIT_UNTIL(task, millis() - task->wake >= 500);
+ * 	}
+ *
+ * 	TASK_END(task);
+ * }
+ * @endcode
+ *
+ * The waits are built from case labels so a task must not use a switch
+ * statement that has a wait inside of it.
+ *
+ * The scheduler holds a fixed number of task slots. scheduler_run() runs every
+ * task once in the order the tasks were added. A task that returns TASK_EXITED
+ * gives up its slot.
+ */
+#ifndef TASK_H_
+#define TASK_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <inttypes.h>
+
+/**
+ * The number of task slots of a scheduler
+ */
+#define TASK_SLOTS 4
+
+/**
+ * Returned by a task that is waiting
+ */
+#define TASK_WAITING 0x00
+
+/**
+ * Returned by a task that has finished
+ */
+#define TASK_EXITED 0x01
+
+/**
+ * Returned by scheduler_add() when every slot is taken
+ */
+#define TASK_NONE 0xFF
+
+typedef struct task task_t;
+
+/**
+ * A structure that represents a task
+ */
+struct task
+{
+	uint16_t resume; /**< the line to pick up from or 0 to start from the top */
+	uint8_t (*run)(task_t *task); /**< the function of the task or 0 if the slot is free */
+	void *data; /**< the structure that the task works on */
+	unsigned long wake; /**< free for the task to time its waits with */
+};
+
+/**
+ * A structure that represents a scheduler
+ */
+typedef struct
+{
+	task_t tasks[TASK_SLOTS]; /**< the task slots */
+} scheduler_t;
+
+/**
+ * Starts the task from the top. Must be the first statement of a task.
+ */
+#define TASK_BEGIN(task) switch ((task)->resume) { case 0:
+
+/**
+ * Returns TASK_WAITING and picks up after this statement the next time the
+ * task is run.
+ */
+#define TASK_YIELD(task) \
+	do { (task)->resume = __LINE__; return TASK_WAITING; case __LINE__:; } while (0)
+
+/**
+ * Marks the fall through into the case label of a wait as on purpose so that
+ * -Wimplicit-fallthrough stays quiet in the tasks
+ */
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define TASK_FALLTHROUGH __attribute__ ((fallthrough))
+#else
+#define TASK_FALLTHROUGH
+#endif
+
+/**
+ * Returns TASK_WAITING until the condition is true
+ */
+#define TASK_WAIT_UNTIL(task, condition) \
+	do { (task)->resume = __LINE__; TASK_FALLTHROUGH; case __LINE__: if (!(condition)) return TASK_WAITING; } while (0)
+
+/**
+ * Ends the task. The next run starts from the top. Must be the last statement
+ * of a task.
+ */
+#define TASK_END(task) } (task)->resume = 0; return TASK_EXITED
+
+/**
+ * @name    Initialize a Task
+ * @brief   Makes the task start from the top the next time it is run.
+ * @ingroup task
+ *
+ * @param [in] task the task that will be initialized
+ */
+static inline void task_init(task_t *task)
+{
+	task->resume = 0;
+}
+
+/**
+ * @name    Initialize the Scheduler
+ * @brief   Frees every task slot.
+ * @ingroup task
+ *
+ * @param [in] scheduler the scheduler that will be initialized
+ */
+void scheduler_init(scheduler_t *scheduler);
+
+/**
+ * @name    Add a Task
+ * @brief   Puts a task in the first free slot.
+ * @ingroup task
+ *
+ * @param [in] scheduler the scheduler that will run the task
+ * @param [in] run the function of the task
+ * @param [in] data the structure that the task works on
+ *
+ * @returns the slot of the task or TASK_NONE if every slot is taken
+ */
+uint8_t scheduler_add(scheduler_t *scheduler, uint8_t (*run)(task_t *task), void *data);
+
+/**
+ * @name    Run the Scheduler
+ * @brief   Runs every task once.
+ * @ingroup task
+ *
+ * The tasks are run in the order of their slots. A task that exits is
+ * removed.
+ *
+ * @param [in] scheduler the scheduler whose tasks will be run
+ *
+ * @returns the number of tasks that are still waiting
+ */
+uint8_t scheduler_run(scheduler_t *scheduler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TASK_H_ */
@@ -0,0 +1,170 @@
+/*
+ * Host microbenchmark of the ring buffer wrap. Times a push and a pop through
+ * the old head and tail indices that wrap with % against ring.h that wraps
+ * with a mask. Run it with
+ *
+ *     make -C test bench
+ *
+ * The serial buffers had a constant size so the compiler could already turn
+ * their % into a mask. The queue kept its capacity in the structure so its %
+ * was a real division. Both are timed. Every ring now passes a constant
+ * capacity, which is the fastest case. On the AVR the division is a call to
+ * __udivmodqi4 (about 80 cycles), so the gap there is larger than on the host.
+ */
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "ring.h"
+
+#define CAPACITY 32
+#define OPERATIONS 20000000UL
+
+/*
+ * The indices of the rings before ring.h. The head and tail are slot
+ * indices that wrap with % so that one slot is always left empty.
+ */
+typedef struct
+{
+	volatile uint8_t head;
+	volatile uint8_t tail;
+} modulo_t;
+
+static uint8_t buffer[CAPACITY];
+
+/*
+ * Keeps the compiler from treating the capacity as a constant, like the
+ * capacity field of the old queue_t.
+ */
+static volatile uint8_t runtime_capacity = CAPACITY;
+
+static uint8_t modulo_push(modulo_t *ring, uint8_t capacity, uint8_t byte)
+{
+	uint8_t head = (uint8_t) ((ring->head + 1) % capacity);
+
+	if (head == ring->tail)
+	{
+		return 0;
+	}
+
+	buffer[ring->head] = byte;
+	ring->head = head;
+
+	return 1;
+}
+
+static uint8_t modulo_pop(modulo_t *ring, uint8_t capacity, uint8_t *byte)
+{
+	if (ring->head == ring->tail)
+	{
+		return 0;
+	}
+
+	*byte = buffer[ring->tail];
+	ring->tail = (uint8_t) ((ring->tail + 1) % capacity);
+
+	return 1;
+}
+
+static uint8_t mask_push(ring_t *ring, uint8_t capacity, uint8_t byte)
+{
+	if (ring_full(ring, capacity))
+	{
+		return 0;
+	}
+
+	buffer[ring_head(ring, capacity)] = byte;
+	ring_push(ring);
+
+	return 1;
+}
+
+static uint8_t mask_pop(ring_t *ring, uint8_t capacity, uint8_t *byte)
+{
+	if (ring_empty(ring))
+	{
+		return 0;
+	}
+
+	*byte = buffer[ring_tail(ring, capacity)];
+	ring_pop(ring);
+
+	return 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned long long ticks(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void report(const char *name, double ns, unsigned long long tsc, unsigned long sum)
+{
+	// Each operation is a push and on average a pop
+	printf("%-26s %6.2f ns/op", name, ns / OPERATIONS);
+
+#ifdef HAVE_TSC
+	printf(" %6.2f tsc/op", (double) tsc / OPERATIONS);
+#endif
+
+	// Printing the sum keeps the loops from being thrown away
+	printf("  (sum %lu)\n", sum);
+}
+
+/*
+ * Runs the same mix of pushes and pops through a ring. Keeps a few bytes in
+ * the ring so that the indices wrap often.
+ */
+#define BENCH(name, ring_type, init, push, pop, capacity) \
+	do { \
+		ring_type ring; \
+		uint8_t byte = 0; \
+		unsigned long sum = 0; \
+		init; \
+		double start = now(); \
+		unsigned long long tsc = ticks(); \
+		for (unsigned long i = 0; i < OPERATIONS; i++) \
+		{ \
+			push(&ring, (capacity), (uint8_t) i); \
+			if (i & 3) \
+			{ \
+				if (pop(&ring, (capacity), &byte)) sum += byte; \
+			} \
+			else \
+			{ \
+				push(&ring, (capacity), (uint8_t) i); \
+			} \
+			if ((i & 15) == 15) \
+			{ \
+				while (pop(&ring, (capacity), &byte)) sum += byte; \
+			} \
+		} \
+		tsc = ticks() - tsc; \
+		report(name, now() - start, tsc, sum); \
+	} while (0)
+
+int main(void)
+{
+	BENCH("% constant capacity", modulo_t, ring.head = ring.tail = 0, modulo_push, modulo_pop, CAPACITY);
+	BENCH("% runtime capacity", modulo_t, ring.head = ring.tail = 0, modulo_push, modulo_pop, runtime_capacity);
+	BENCH("mask constant capacity", ring_t, ring_init(&ring), mask_push, mask_pop, CAPACITY);
+	BENCH("mask runtime capacity", ring_t, ring_init(&ring), mask_push, mask_pop, runtime_capacity);
+
+	return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Counts the cycles that one step of the stepper spends writing its coils.
+ * The four digitalWrite() calls that stepper_step() used to make are timed
+ * against the single port write of stepper_write() in stepper.c. Timer1 runs
+ * without a prescaler so every count is one cycle (62.5nS at 16MHz).
+ *
+ * The motor driver can stay connected to pins 2-5. The results are printed on
+ * the serial port once a second.
+ *
+ * Cycles per step over write_none() for the full step sequence, with Timer0
+ * and Timer2 set up for PWM like init() leaves them:
+ *
+ *     digitalWrite   356 (89 per call, pins 3 and 5 also turn off PWM)
+ *     port write      10
+ *
+ * These were counted by running the llc (LLVM 14, -O2, atmega328p) output
+ * of write_digital(), write_port() and the core's digitalWrite() and
+ * turnOffPWM() through an instruction-level cycle count. The counts use the
+ * cycle table of the datasheet. avr-gcc schedules the same code a little
+ * differently, so the numbers from a board may be a few cycles off.
+ */
+#include <util/atomic.h>
+
+#include "../../pins.h"
+
+// The pins of the first control line on, like the old stepper_init() call
+#define PIN0 2
+#define PIN1 3
+#define PIN2 4
+#define PIN3 5
+
+// The number of steps that are timed. Small enough for Timer1 not to wrap.
+#define STEPS 64
+
+static const uint8_t full_step[4] = {0x05, 0x06, 0x0A, 0x09};
+
+// Volatile so that the compiler can't work out the phases ahead of time
+static volatile uint8_t phase = 0;
+
+// The coil writes of one step before pins.h
+static void write_digital(uint8_t coils)
+{
+	digitalWrite(PIN0, (coils & 0x01) ? HIGH : LOW);
+	digitalWrite(PIN1, (coils & 0x02) ? HIGH : LOW);
+	digitalWrite(PIN2, (coils & 0x04) ? HIGH : LOW);
+	digitalWrite(PIN3, (coils & 0x08) ? HIGH : LOW);
+}
+
+// The coil writes of one step in stepper.c
+static void write_port(uint8_t coils)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		STEPPER_PORT = (STEPPER_PORT & ~STEPPER_MASK) | ((coils << STEPPER_SHIFT) & STEPPER_MASK);
+	}
+}
+
+// Does everything but the write so that the loop can be taken out
+static void write_none(uint8_t coils)
+{
+	(void) coils;
+}
+
+// Gets the number of cycles that STEPS steps take with the given write
+static uint16_t time_steps(void (*write)(uint8_t))
+{
+	uint16_t cycles;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		TCNT1 = 0;
+
+		for (uint8_t i = 0; i < STEPS; i++)
+		{
+			write(full_step[phase]);
+			phase = (phase + 1) & 0x03;
+		}
+
+		cycles = TCNT1;
+	}
+
+	return cycles;
+}
+
+void setup()
+{
+	pinMode(PIN0, OUTPUT);
+	pinMode(PIN1, OUTPUT);
+	pinMode(PIN2, OUTPUT);
+	pinMode(PIN3, OUTPUT);
+
+	// Timer1 in normal mode with no prescaler
+	TCCR1A = 0;
+	TCCR1B = (1 << CS10);
+
+	Serial.begin(9600);
+}
+
+void loop()
+{
+	uint16_t none = time_steps(write_none);
+	uint16_t digital = time_steps(write_digital);
+	uint16_t port = time_steps(write_port);
+
+	Serial.print("cycles/step digitalWrite: ");
+	Serial.print((digital - none) / STEPS);
+	Serial.print(" port write: ");
+	Serial.println((port - none) / STEPS);
+
+	delay(1000);
+}
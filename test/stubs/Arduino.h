@@ -0,0 +1,24 @@
+/*
+ * The parts of the Arduino core that the host tests need. The test supplies
+ * millis().
+ */
+#ifndef ARDUINO_H_
+#define ARDUINO_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+unsigned long millis(void);
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARDUINO_H_ */
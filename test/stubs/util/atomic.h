@@ -0,0 +1,11 @@
+/*
+ * The host tests have no interrupts so an atomic block is a plain block that
+ * runs once.
+ */
+#ifndef UTIL_ATOMIC_H_
+#define UTIL_ATOMIC_H_
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (uint8_t atomic_once = 1; atomic_once; atomic_once = 0)
+
+#endif /* UTIL_ATOMIC_H_ */
@@ -0,0 +1,321 @@
+/*
+ * Host test of the pour and reset sequences. They run as tasks of the
+ * scheduler like they do in the sketch. The clock, the stepper and the
+ * actuator are faked so every pass of the main loop is one millisecond.
+ */
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "bartender.h"
+#include "error.h"
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+static unsigned long now;
+static uint8_t actuator; /* UP, DOWN or 0 when stopped */
+
+unsigned long millis(void)
+{
+	return now;
+}
+
+void toggle_driver_move(toggle_driver_t *driver, uint8_t dir)
+{
+	(void) driver;
+	actuator = dir;
+}
+
+void toggle_driver_stop(toggle_driver_t *driver)
+{
+	(void) driver;
+	actuator = 0;
+}
+
+uint8_t stepper_start(stepper_t *stepper, uint16_t steps, uint16_t planned, uint8_t direction)
+{
+	(void) planned;
+
+	stepper->steps = steps;
+	stepper->direction = direction;
+	stepper->running = 1;
+
+	return E_NO_ERROR;
+}
+
+uint8_t stepper_running(stepper_t *stepper)
+{
+	return stepper->running;
+}
+
+uint16_t stepper_taken(stepper_t *stepper)
+{
+	return stepper->running ? 0 : stepper->steps;
+}
+
+void stepper_halt(stepper_t *stepper)
+{
+	stepper->running = 0;
+}
+
+void stepper_release(stepper_t *stepper)
+{
+	(void) stepper;
+}
+
+static stepper_t stepper;
+static toggle_driver_t toggler;
+static scheduler_t scheduler;
+static bartender_t bartender;
+
+static void setup(void)
+{
+	now = 0;
+	actuator = 0;
+	stepper.mode = STEPPER_FULL_STEP;
+	stepper.running = 0;
+
+	scheduler_init(&scheduler);
+	bartender_init(&bartender, &stepper, &toggler, &scheduler, 1);
+}
+
+/*
+ * One pass of the main loop. Returns what bartender_update() returned.
+ */
+static uint8_t pass(void)
+{
+	scheduler_run(&scheduler);
+	uint8_t code = bartender_update(&bartender);
+	now++;
+
+	return code;
+}
+
+/*
+ * Runs the main loop until the bartender is done and returns how long it took
+ */
+static unsigned long run_until_done(unsigned long limit)
+{
+	unsigned long start = now;
+
+	while (now - start < limit)
+	{
+		if (pass() != E_BUSY)
+		{
+			return now - start;
+		}
+	}
+
+	return limit;
+}
+
+static void test_pour(void)
+{
+	bartender_event_t event;
+
+	setup();
+	bartender.flows[1] = 10;
+
+	CHECK(bartender_pour_ml(&bartender, 100) == E_NO_ERROR);
+	CHECK(bartender.status == STATUS_POURING);
+
+	// The sequence starts on the next pass
+	CHECK(actuator == 0);
+	pass();
+	CHECK(actuator == UP);
+	CHECK(bartender_next_event(&bartender, &event) == E_NO_ERROR && event.code == EVENT_POUR_STARTED);
+
+	// Held up for the flow of 100 ml
+	while (now <= bartender.up_times[1])
+	{
+		pass();
+	}
+
+	CHECK(actuator == 0);
+
+	unsigned long took = run_until_done(60000);
+	unsigned long expected = bartender.up_times[1] + 1000 + min(bartender.clearance_time, bartender.down_time);
+
+	// Done once the glass is clear and the actuator is still lowering
+	CHECK(now >= expected && now <= expected + 2);
+	CHECK(took < 60000);
+	CHECK(actuator == DOWN);
+	CHECK(bartender.retracting);
+	CHECK(bartender_next_event(&bartender, &event) == E_NO_ERROR && event.code == EVENT_POUR_DONE);
+
+	// The sequence gave up its slot
+	CHECK(scheduler_run(&scheduler) == 0);
+
+	// The stroke is stopped at the bottom while nothing else is going on
+	for (uint16_t i = 0; i < bartender.down_time; i++)
+	{
+		pass();
+	}
+
+	CHECK(actuator == 0);
+	CHECK(!bartender.retracting);
+}
+
+static void test_long_pour(void)
+{
+	setup();
+
+	// 2000 ml at the default flow is a 100 s hold
+	CHECK(bartender_pour_ml(&bartender, 2000) == E_NO_ERROR);
+	CHECK(bartender.hold == 2000UL * POUR_FLOW);
+
+	run_until_done(200000);
+
+	unsigned long expected = bartender.up_times[1] + 2000UL * POUR_FLOW + min(bartender.clearance_time, bartender.down_time);
+
+	CHECK(now >= expected && now <= expected + 2);
+}
+
+static void test_stop_ends_pour(void)
+{
+	setup();
+
+	CHECK(bartender_pour(&bartender, 1) == E_NO_ERROR);
+
+	for (int i = 0; i < 100; i++)
+	{
+		pass();
+	}
+
+	CHECK(actuator == UP);
+
+	bartender_stop(&bartender);
+	CHECK(actuator == 0);
+
+	// The sequence notices the stop and does not touch the actuator again
+	for (int i = 0; i < 20000; i++)
+	{
+		CHECK(pass() == E_INT);
+	}
+
+	CHECK(actuator == 0);
+	CHECK(scheduler_run(&scheduler) == 0);
+}
+
+static void test_reset(void)
+{
+	setup();
+	bartender_stop(&bartender);
+
+	CHECK(bartender_reset(&bartender) == E_NO_ERROR);
+
+	pass();
+	CHECK(actuator == DOWN);
+
+	// Lowers the actuator and then heads home
+	while (bartender.status == STATUS_RESETTING && now < 20000)
+	{
+		pass();
+	}
+
+	CHECK(now >= bartender.down_time && now <= bartender.down_time + 2UL);
+	CHECK(actuator == 0);
+	CHECK(stepper.running && stepper.direction == REVERSE);
+
+	// The bump sensor is hit
+	bartender_bump(&bartender);
+	CHECK(run_until_done(10) < 10);
+	CHECK(bartender.location == 0);
+	CHECK(scheduler_run(&scheduler) == 0);
+}
+
+/*
+ * Lets the fake stepper finish its move
+ */
+static void finish_move(void)
+{
+	stepper.running = 0;
+	pass();
+}
+
+static void test_calibrate_from_home(void)
+{
+	setup();
+	bartender_init(&bartender, &stepper, &toggler, &scheduler, 0);
+
+	uint16_t reference = bartender.offsets[BARTENDER_LOCATIONS - 1];
+	uint16_t offset = bartender.offsets[5];
+
+	CHECK(bartender_calibrate(&bartender) == E_NO_ERROR);
+
+	// Sitting on the sensor so it backs away first
+	CHECK(stepper.running && stepper.direction == FORWARD);
+	CHECK(stepper.steps == CALIBRATE_BACKOFF);
+	finish_move();
+
+	// Then homes until the sensor is pressed
+	CHECK(stepper.running && stepper.direction == REVERSE);
+	bartender_bump(&bartender);
+	CHECK(pass() == E_BUSY);
+
+	// Out to the last location
+	CHECK(stepper.running && stepper.direction == FORWARD);
+	CHECK(stepper.steps == reference);
+	finish_move();
+
+	// And crawls back. The rail is 1% longer than the table says.
+	CHECK(stepper.running && stepper.direction == REVERSE);
+	stepper.steps = reference + reference / 100;
+	bartender_bump(&bartender);
+
+	CHECK(pass() == E_NO_ERROR);
+	CHECK(bartender.location == 0);
+	CHECK(bartender.offsets[BARTENDER_LOCATIONS - 1] == reference + reference / 100);
+	CHECK(bartender.offsets[5] >= offset + offset / 100 - 1 && bartender.offsets[5] <= offset + offset / 100 + 1);
+}
+
+static void test_calibrate_without_reference(void)
+{
+	setup();
+
+	// Nothing to scale by
+	bartender.offsets[BARTENDER_LOCATIONS - 1] = 0;
+
+	CHECK(bartender_calibrate(&bartender) == E_INV_CALL);
+	CHECK(bartender.status == STATUS_NONE);
+	CHECK(!stepper.running);
+}
+
+static uint8_t idle_task(task_t *task)
+{
+	(void) task;
+	return TASK_WAITING;
+}
+
+static void test_no_slot(void)
+{
+	setup();
+
+	// Every slot is taken
+	while (scheduler_add(&scheduler, idle_task, 0) != TASK_NONE);
+
+	CHECK(bartender_pour(&bartender, 1) == E_BUSY);
+	CHECK(bartender.status == STATUS_NONE);
+}
+
+int main(void)
+{
+	test_pour();
+	test_long_pour();
+	test_stop_ends_pour();
+	test_reset();
+	test_calibrate_from_home();
+	test_calibrate_without_reference();
+	test_no_slot();
+
+	if (failures)
+	{
+		printf("test_bartender: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("test_bartender: ok\n");
+	return 0;
+}
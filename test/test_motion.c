@@ -0,0 +1,220 @@
+/*
+ * Host test of the motion planner. Checks the delay of every step against the
+ * v(n)^2 = v0^2 + 2 * a * n ramp and the shape of the planned moves.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "motion.h"
+
+/*
+ * The full steps of a move from location 1 to 12 with the distances in
+ * bartender.c
+ */
+#define STEPS_1_TO_12 (635 + 675 + 675 + 660 + 675 + 675 + 675 + 675 + 675 + 645 + 675)
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+/*
+ * The delay the ramp should give at a speed squared. The planner works in
+ * whole steps per second and whole microseconds so this does too.
+ */
+static double expected_delay(const motion_config_t *config, double vsq)
+{
+	double delay = floor(1000000.0 / floor(sqrt(vsq)));
+
+	if (delay > config->start_delay)
+	{
+		return config->start_delay;
+	}
+
+	if (delay < config->cruise_delay)
+	{
+		return config->cruise_delay;
+	}
+
+	return delay;
+}
+
+static void test_ramp_delays(void)
+{
+	motion_config_t config;
+	motion_profile_t profile;
+
+	motion_config_init(&config);
+	motion_plan(&profile, &config, 2000);
+
+	double v0 = floor(1000000.0 / config.start_delay);
+	uint16_t last = 0xFFFF;
+
+	CHECK(profile.accel_steps > 0);
+	CHECK(profile.accel_steps == profile.decel_steps);
+
+	for (uint16_t n = 0; n < profile.steps; n++)
+	{
+		uint16_t delay = motion_next_delay(&profile);
+
+		CHECK(delay >= config.cruise_delay && delay <= config.start_delay);
+
+		if (n < profile.accel_steps)
+		{
+			// Speeding up
+			CHECK(delay == expected_delay(&config, v0 * v0 + 2.0 * config.accel * n));
+			CHECK(delay <= last);
+		}
+		else if (n >= profile.steps - profile.decel_steps)
+		{
+			// Slowing down
+			uint16_t remaining = profile.steps - n - 1;
+
+			CHECK(delay == expected_delay(&config, v0 * v0 + 2.0 * config.decel * remaining));
+			CHECK(delay >= last);
+		}
+		else
+		{
+			CHECK(delay == config.cruise_delay);
+		}
+
+		last = delay;
+	}
+
+	// Starts and ends at the start speed
+	motion_plan(&profile, &config, 2000);
+	CHECK(motion_next_delay(&profile) == config.start_delay);
+
+	for (uint16_t n = 1; n < profile.steps - 1; n++)
+	{
+		motion_next_delay(&profile);
+	}
+
+	CHECK(motion_next_delay(&profile) == config.start_delay);
+}
+
+static void test_triangular(void)
+{
+	motion_config_t config;
+	motion_profile_t profile;
+
+	motion_config_init(&config);
+	config.accel = 4000;
+	config.decel = 2000;
+
+	// Too short to reach the cruise speed
+	motion_plan(&profile, &config, 90);
+
+	// The ramps split the move in the ratio of the rates
+	CHECK(profile.accel_steps + profile.decel_steps == 90);
+	CHECK(profile.accel_steps == 30);
+	CHECK(profile.decel_steps == 60);
+
+	uint16_t fastest = 0xFFFF;
+	uint16_t fastest_step = 0;
+
+	for (uint16_t n = 0; n < 90; n++)
+	{
+		uint16_t delay = motion_next_delay(&profile);
+
+		// Never gets to cruise
+		CHECK(delay > config.cruise_delay);
+
+		if (delay < fastest)
+		{
+			fastest = delay;
+			fastest_step = n;
+		}
+	}
+
+	// The peak is where the ramps meet
+	CHECK(fastest_step + 1 >= profile.accel_steps && fastest_step <= profile.accel_steps);
+}
+
+static void test_long_move(void)
+{
+	motion_config_t config;
+	motion_profile_t profile;
+
+	motion_config_init(&config);
+	motion_plan(&profile, &config, STEPS_1_TO_12);
+
+	unsigned long cruising = 0;
+	unsigned long total = 0;
+
+	for (uint16_t n = 0; n < STEPS_1_TO_12; n++)
+	{
+		uint16_t delay = motion_next_delay(&profile);
+
+		total += delay;
+
+		if (delay == config.cruise_delay)
+		{
+			cruising++;
+		}
+	}
+
+	unsigned long fixed = (unsigned long) STEPS_1_TO_12 * config.start_delay;
+
+	// Most of the move is spent at the cruise speed
+	CHECK(cruising * 10 >= STEPS_1_TO_12 * 9UL);
+	CHECK(total * 2 < fixed);
+
+	printf("1->12: %u steps, %lu at cruise (%.1f%%), %.2f s instead of %.2f s\n",
+			STEPS_1_TO_12, cruising, 100.0 * cruising / STEPS_1_TO_12, total / 1e6, fixed / 1e6);
+}
+
+static void test_crawl(void)
+{
+	motion_config_t config;
+	motion_profile_t profile;
+
+	motion_config_init(&config);
+	motion_plan(&profile, &config, 10);
+
+	for (uint16_t n = 0; n < 10; n++)
+	{
+		motion_next_delay(&profile);
+	}
+
+	// Past the end of the move it crawls at the start speed
+	for (uint16_t n = 0; n < 1000; n++)
+	{
+		CHECK(motion_next_delay(&profile) == config.start_delay);
+	}
+
+	CHECK(profile.step == 10);
+}
+
+static void test_no_ramps(void)
+{
+	motion_config_t config;
+	motion_profile_t profile;
+
+	motion_config_init(&config);
+	config.accel = 0;
+	motion_plan(&profile, &config, 100);
+
+	for (uint16_t n = 0; n < 100; n++)
+	{
+		CHECK(motion_next_delay(&profile) == config.start_delay);
+	}
+}
+
+int main(void)
+{
+	test_ramp_delays();
+	test_triangular();
+	test_long_move();
+	test_crawl();
+	test_no_ramps();
+
+	if (failures)
+	{
+		printf("test_motion: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("test_motion: ok\n");
+	return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * Host test of the message parser. Feeds clean and corrupted streams and
+ * checks that the messages after a corrupted one still come out. The content
+ * of the messages is random so it holds start and stop bytes too. Reports how
+ * many bytes it took from the damage to the next message.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "parser.h"
+#include "protocol.h"
+
+#define STREAM_MAX 512
+#define TRIALS 10000
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+/*
+ * What came out of the parser
+ */
+typedef struct
+{
+	uint8_t frames[64][MSG_SIZE];
+	uint16_t at[64]; /* the number of bytes that had been fed */
+	uint8_t count;
+	uint8_t errors;
+} output_t;
+
+static uint32_t seed = 1;
+
+static uint8_t random_byte(void)
+{
+	// xorshift32 so every run is the same
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return (uint8_t) seed;
+}
+
+static uint8_t build_cmd(uint8_t *buffer, uint8_t cmd, uint8_t seq, uint8_t len)
+{
+	buffer[I_START] = MSG_START;
+	buffer[I_LEN] = len;
+	buffer[I_TYPE] = TYPE_CMD;
+	buffer[I_CMD] = cmd;
+	buffer[I_RSP_CODE] = BLANK;
+	buffer[I_SEQ] = seq;
+
+	for (uint8_t i = 0; i < len; i++)
+	{
+		buffer[I_PAYLOAD + i] = random_byte();
+	}
+
+	buffer[I_END(len)] = MSG_END;
+
+	return MSG_FRAME_SIZE(len);
+}
+
+/*
+ * Feeds the stream the same way the receive interrupt does
+ */
+static void run(const uint8_t *stream, uint16_t size, output_t *out)
+{
+	parser_t parser;
+	uint8_t buffer[MSG_SIZE];
+
+	parser_init(&parser);
+	memset(out, 0, sizeof(*out));
+
+	for (uint16_t i = 0; i < size; i++)
+	{
+		uint8_t result = parser_feed(&parser, buffer, stream[i]);
+
+		while (result != PARSER_MORE)
+		{
+			if (result == PARSER_ERROR)
+			{
+				out->errors++;
+			}
+			else if (out->count < 64)
+			{
+				memcpy(out->frames[out->count], buffer, MSG_SIZE);
+				out->at[out->count] = i + 1;
+				out->count++;
+			}
+
+			result = parser_replay(&parser, buffer);
+		}
+	}
+}
+
+static void test_clean_stream(void)
+{
+	uint8_t stream[STREAM_MAX];
+	uint16_t size = 0;
+	output_t out;
+
+	for (uint8_t i = 0; i < 20; i++)
+	{
+		size += build_cmd(&stream[size], CMD_MOVE, i + 1, i % (MSG_MAX_PAYLOAD + 1));
+	}
+
+	run(stream, size, &out);
+
+	CHECK(out.count == 20);
+	CHECK(out.errors == 0);
+
+	for (uint8_t i = 0; i < out.count; i++)
+	{
+		CHECK(out.frames[i][I_SEQ] == i + 1);
+	}
+}
+
+/*
+ * A length that swallows the messages after it
+ */
+static void test_long_length(void)
+{
+	uint8_t stream[STREAM_MAX];
+	uint16_t size = 0;
+	output_t out;
+
+	size += build_cmd(&stream[size], CMD_MOVE, 1, LEN_MOVE);
+	stream[I_LEN] = 20;
+	size += build_cmd(&stream[size], CMD_MOVE, 2, LEN_MOVE);
+	size += build_cmd(&stream[size], CMD_MOVE, 3, LEN_MOVE);
+	size += build_cmd(&stream[size], CMD_STATUS, 4, 0);
+
+	run(stream, size, &out);
+
+	CHECK(out.errors == 1);
+	CHECK(out.count == 3);
+
+	for (uint8_t i = 0; i < out.count; i++)
+	{
+		CHECK(out.frames[i][I_SEQ] == i + 2);
+	}
+
+	CHECK(out.frames[2][I_CMD] == CMD_STATUS);
+}
+
+/*
+ * Drops, adds or changes one byte of one message of a stream and checks that
+ * every other message comes out unchanged and in order
+ */
+static void test_corrupted_streams(void)
+{
+	uint8_t clean[STREAM_MAX];
+	uint8_t stream[STREAM_MAX];
+	uint16_t ends[16];
+	uint8_t sizes[16];
+	output_t out;
+
+	unsigned long latency_total = 0;
+	unsigned long latency_count = 0;
+	uint16_t latency_max = 0;
+	unsigned swallowed = 0;
+
+	for (int trial = 0; trial < TRIALS; trial++)
+	{
+		uint16_t size = 0;
+		uint8_t messages = 2 + random_byte() % 12;
+
+		for (uint8_t i = 0; i < messages; i++)
+		{
+			sizes[i] = build_cmd(&clean[size], CMD_MOVE, i + 1, random_byte() % (MSG_MAX_PAYLOAD + 1));
+			size += sizes[i];
+			ends[i] = size;
+		}
+
+		// A length that is too long is only found out when enough bytes have
+		// arrived to fill it. Stand in for the traffic that comes later.
+		for (uint8_t i = 0; i < MSG_SIZE; i++)
+		{
+			clean[size + i] = random_byte();
+		}
+
+		uint16_t padded = size + MSG_SIZE;
+
+		// Pick the message and the byte to damage
+		uint8_t bad = random_byte() % messages;
+		uint16_t offset = ends[bad] - sizes[bad] + random_byte() % sizes[bad];
+		uint8_t kind = random_byte() % 3;
+		int shift = 0;
+
+		memcpy(stream, clean, offset);
+
+		if (kind == 0)
+		{
+			// Dropped
+			memcpy(&stream[offset], &clean[offset + 1], padded - offset - 1);
+			shift = -1;
+		}
+		else if (kind == 1)
+		{
+			// Extra
+			stream[offset] = random_byte();
+			memcpy(&stream[offset + 1], &clean[offset], padded - offset);
+			shift = 1;
+		}
+		else
+		{
+			// Changed
+			uint8_t byte;
+
+			do
+			{
+				byte = random_byte();
+			} while (byte == clean[offset]);
+
+			memcpy(&stream[offset], &clean[offset], padded - offset);
+			stream[offset] = byte;
+		}
+
+		run(stream, padded + shift, &out);
+
+		// The first byte that arrived after the damage
+		uint16_t after = offset + (kind != 0);
+
+		// Every message before the damaged one comes out as it was sent. After
+		// it the parser may also put out the damaged message and false
+		// messages that begin at a start byte in some content. There is no
+		// checksum so a false message that happens to end on a stop byte is
+		// taken and may swallow the start of a real one.
+		uint8_t ok = 1;
+		uint8_t lost = 0;
+		uint8_t found = 0;
+
+		for (uint8_t m = 0; m < messages; m++)
+		{
+			if (m == bad)
+			{
+				continue;
+			}
+
+			uint8_t i = found;
+
+			while (i < out.count && memcmp(out.frames[i], &clean[ends[m] - sizes[m]], sizes[m]) != 0)
+			{
+				i++;
+			}
+
+			// Nothing may come out before the damage that was not sent
+			if (m < bad && i != found)
+			{
+				ok = 0;
+			}
+
+			if (i == out.count)
+			{
+				if (m < bad)
+				{
+					ok = 0;
+				}
+
+				lost++;
+				continue;
+			}
+
+			found = i + 1;
+		}
+
+		if (!ok)
+		{
+			printf("trial %d: kind %d at byte %u of message %u lost a message\n", trial, kind, offset, bad + 1);
+			failures++;
+			continue;
+		}
+
+		if (lost)
+		{
+			swallowed++;
+		}
+
+		// How many bytes after the damage the next message that began after
+		// it came out. Its own bytes are not counted.
+		for (uint8_t i = 0; i < out.count && bad < messages - 1; i++)
+		{
+			int latency = (int) out.at[i] - MSG_FRAME_SIZE(out.frames[i][I_LEN]) - after;
+
+			if (latency >= 0)
+			{
+				latency_total += latency;
+				latency_count++;
+
+				if ((uint16_t) latency > latency_max)
+				{
+					latency_max = latency;
+				}
+
+				break;
+			}
+		}
+	}
+
+	// Back in sync within one message
+	CHECK(latency_max <= MSG_SIZE);
+
+	// A false message that ends on a stop byte takes about one in 256 false
+	// starts. Anything more means the parser lost sync on its own.
+	CHECK(swallowed * 1000 <= TRIALS);
+
+	printf("bytes from the damage to the next message: mean %.2f, max %u over %lu trials\n",
+			latency_count ? (double) latency_total / latency_count : 0.0, latency_max, latency_count);
+	printf("trials where a false message swallowed a real one: %u of %d\n", swallowed, TRIALS);
+}
+
+int main(void)
+{
+	test_clean_stream();
+	test_long_length();
+	test_corrupted_streams();
+
+	if (failures)
+	{
+		printf("test_parser: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("test_parser: ok\n");
+	return 0;
+}
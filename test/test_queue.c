@@ -0,0 +1,176 @@
+/*
+ * Host test of the queue. Checks that a STOP that clears the queue while the
+ * main loop is reading a command in place never hands that slot to the
+ * receive interrupt and that releasing the old command never removes a new
+ * one.
+ */
+#include <stdio.h>
+
+#include "queue.h"
+#include "error.h"
+
+#define SLOTS QUEUE_CAPACITY
+#define SIZE 4
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+static uint8_t data[SLOTS * SIZE];
+
+/*
+ * Writes a message into the next slot like the receive interrupt does
+ */
+static uint8_t *receive(queue_t *queue, uint8_t id)
+{
+	uint8_t *slot = queue_reserve(queue);
+
+	if (slot == 0)
+	{
+		return 0;
+	}
+
+	for (uint8_t i = 0; i < SIZE; i++)
+	{
+		slot[i] = id;
+	}
+
+	CHECK(queue_commit(queue) == E_NO_ERROR);
+
+	return slot;
+}
+
+static void test_fifo(void)
+{
+	queue_t queue;
+	uint8_t out[SIZE];
+
+	queue_init(&queue, data, SIZE, SLOTS);
+
+	// Go around the ring a few times
+	for (uint8_t id = 0; id < 3 * SLOTS; id++)
+	{
+		CHECK(receive(&queue, id) != 0);
+		CHECK(queue_dequeue(&queue, out) == E_NO_ERROR);
+		CHECK(out[0] == id);
+	}
+
+	CHECK(queue_size(&queue) == 0);
+	CHECK(queue_dequeue(&queue, out) == E_EMPTY);
+}
+
+static void test_clear_full(void)
+{
+	queue_t queue;
+
+	queue_init(&queue, data, SIZE, SLOTS);
+
+	for (uint8_t id = 1; id <= SLOTS; id++)
+	{
+		CHECK(receive(&queue, id) != 0);
+	}
+
+	// The main loop starts on the first command and a STOP clears the queue
+	uint8_t *cmd = queue_peek(&queue);
+	CHECK(cmd != 0 && cmd[0] == 1);
+
+	CHECK(queue_clear(&queue) == E_NO_ERROR);
+	CHECK(queue_size(&queue) == 0);
+
+	// The head wrapped onto the command that is being read
+	CHECK(queue_reserve(&queue) == 0);
+	CHECK(cmd[0] == 1);
+
+	// The old command is not in the queue anymore
+	CHECK(queue_release(&queue, cmd) == E_EMPTY);
+
+	// Now the slot can be used again
+	CHECK(receive(&queue, 9) == cmd);
+	CHECK(queue_peek(&queue) == cmd && cmd[0] == 9);
+	CHECK(queue_release(&queue, cmd) == E_NO_ERROR);
+	CHECK(queue_size(&queue) == 0);
+}
+
+static void test_clear_wrap(void)
+{
+	queue_t queue;
+
+	queue_init(&queue, data, SIZE, SLOTS);
+
+	for (uint8_t id = 1; id <= 3; id++)
+	{
+		CHECK(receive(&queue, id) != 0);
+	}
+
+	uint8_t *cmd = queue_peek(&queue);
+	CHECK(queue_clear(&queue) == E_NO_ERROR);
+
+	// New commands arrive while the old one is still being handled. Every
+	// slot but the one that is being read can be filled.
+	uint8_t received = 0;
+
+	for (uint8_t id = 10; id < 10 + SLOTS; id++)
+	{
+		uint8_t *slot = receive(&queue, id);
+
+		CHECK(slot != cmd);
+
+		if (slot != 0)
+		{
+			received++;
+		}
+	}
+
+	CHECK(received == SLOTS - 3);
+	CHECK(cmd[0] == 1);
+
+	// Releasing the old command leaves the new ones alone
+	CHECK(queue_release(&queue, cmd) == E_EMPTY);
+	CHECK(queue_size(&queue) == received);
+
+	uint8_t *next = queue_peek(&queue);
+	CHECK(next != 0 && next[0] == 10);
+	CHECK(queue_release(&queue, next) == E_NO_ERROR);
+
+	// The slot that was read is free again
+	CHECK(receive(&queue, 20) == cmd);
+}
+
+static void test_limit(void)
+{
+	queue_t queue;
+	uint8_t out[SIZE];
+
+	queue_init(&queue, data, SIZE, 2);
+
+	// The queue stops at its limit but still goes around every slot
+	for (uint8_t id = 0; id < 3 * SLOTS; id++)
+	{
+		CHECK(receive(&queue, id) != 0);
+		CHECK(receive(&queue, id) != 0);
+		CHECK(receive(&queue, id) == 0);
+		CHECK(queue_size(&queue) == 2);
+
+		CHECK(queue_dequeue(&queue, out) == E_NO_ERROR);
+		CHECK(queue_dequeue(&queue, out) == E_NO_ERROR);
+		CHECK(out[0] == id);
+	}
+}
+
+int main(void)
+{
+	test_fifo();
+	test_limit();
+	test_clear_full();
+	test_clear_wrap();
+
+	if (failures)
+	{
+		printf("test_queue: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("test_queue: ok\n");
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Host test of the task scheduler. Pushes thousands of simulated tasks through
+ * the fixed slots and checks that every task picks up where it left off, that
+ * no wait ends early or late and that the order of the runs is the same every
+ * time.
+ */
+#include <stdio.h>
+
+#include "task.h"
+
+#define TASKS 5000
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+/*
+ * A simulated task. It takes a number of steps and waits a number of passes
+ * between them.
+ */
+typedef struct
+{
+	uint16_t id;
+	uint8_t steps; /* the number of steps to take */
+	uint8_t period; /* the passes to wait between steps or 0 to yield */
+	uint8_t taken; /* the number of steps taken */
+	unsigned long last; /* the pass of the last step */
+} sim_t;
+
+static scheduler_t scheduler;
+static sim_t sims[TASKS];
+
+static unsigned long now; /* the pass of the scheduler */
+static uint32_t trace; /* a hash of every run in order */
+static int last_slot; /* the slot that ran last in this pass */
+
+static uint32_t seed;
+
+static uint32_t random_number(void)
+{
+	// xorshift32 so every run is the same
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+static void record(task_t *task, uint16_t id)
+{
+	int slot = (int) (task - scheduler.tasks);
+
+	// The slots are run in order
+	CHECK(slot > last_slot);
+	last_slot = slot;
+
+	trace = (trace ^ id ^ ((uint32_t) slot << 16)) * 16777619UL;
+}
+
+static uint8_t sim_task(task_t *task)
+{
+	sim_t *sim = (sim_t *) task->data;
+
+	record(task, sim->id);
+
+	TASK_BEGIN(task);
+
+	while (sim->taken < sim->steps)
+	{
+		if (sim->taken > 0)
+		{
+			// The wait ended on the first pass that it could
+			CHECK(now == sim->last + (sim->period ? sim->period : 1));
+		}
+
+		sim->taken++;
+		sim->last = now;
+
+		if (sim->period == 0)
+		{
+			TASK_YIELD(task);
+		}
+		else
+		{
+			task->wake = now;
+			TASK_WAIT_UNTIL(task, now - task->wake >= sim->period);
+		}
+	}
+
+	TASK_END(task);
+}
+
+/*
+ * Runs every task to the end and returns the hash of the runs
+ */
+static uint32_t run(uint32_t start)
+{
+	uint16_t added = 0;
+	uint8_t waiting = 0;
+
+	seed = start;
+	trace = 2166136261UL;
+	now = 0;
+
+	scheduler_init(&scheduler);
+
+	for (uint16_t i = 0; i < TASKS; i++)
+	{
+		sims[i].id = i;
+		sims[i].steps = 1 + random_number() % 20;
+		sims[i].period = random_number() % 6;
+		sims[i].taken = 0;
+	}
+
+	while (added < TASKS || waiting > 0)
+	{
+		// Fill the free slots. Now and then leave one empty.
+		while (added < TASKS && random_number() % 8 != 0)
+		{
+			uint8_t slot = scheduler_add(&scheduler, sim_task, &sims[added]);
+
+			if (slot == TASK_NONE)
+			{
+				// Only when every slot is taken
+				CHECK(waiting == TASK_SLOTS);
+				break;
+			}
+
+			waiting++;
+			added++;
+		}
+
+		last_slot = -1;
+		waiting = scheduler_run(&scheduler);
+		now++;
+	}
+
+	// Every step of every task was taken
+	for (uint16_t i = 0; i < TASKS; i++)
+	{
+		CHECK(sims[i].taken == sims[i].steps);
+	}
+
+	return trace;
+}
+
+int main(void)
+{
+	uint32_t first = run(12345);
+	unsigned long passes = now;
+
+	// The same tasks run in the same order every time
+	CHECK(run(12345) == first);
+	CHECK(run(54321) != first);
+
+	if (failures)
+	{
+		printf("test_task: %d failures\n", failures);
+		return 1;
+	}
+
+	printf("%d tasks through %d slots in %lu passes\n", TASKS, TASK_SLOTS, passes);
+	printf("test_task: ok\n");
+	return 0;
+}
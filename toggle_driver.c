@@ -1,31 +1,51 @@
-#include "Arduino.h"
 #include "toggle_driver.h"
+#include "pins.h"
 
-void toggle_driver_init(toggle_driver_t *driver, uint8_t pin1, uint8_t pin2)
+#include <util/atomic.h>
+
+static void toggle_driver_write(uint8_t lines);
+
+/**
+ * Writes both control lines in one port write. The stepper interrupt may
+ * share the port so this must not be interrupted.
+ */
+static void toggle_driver_write(uint8_t lines)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		TOGGLE_PORT = (TOGGLE_PORT & ~TOGGLE_MASK) | lines;
+	}
+}
+
+void toggle_driver_init(toggle_driver_t *driver)
 {
-	driver->pin1 = pin1;
-	driver->pin2 = pin2;
+	driver->dir = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		TOGGLE_DDR |= TOGGLE_MASK;
+	}
 
-	pinMode(driver->pin1, OUTPUT);
-	pinMode(driver->pin2, OUTPUT);
+	toggle_driver_write(0);
 }
 
 void toggle_driver_move(toggle_driver_t *driver, uint8_t dir)
 {
+	driver->dir = dir;
+
 	if (dir == UP)
 	{
-		digitalWrite(driver->pin1, HIGH);
-		digitalWrite(driver->pin2, LOW);
+		toggle_driver_write(1 << TOGGLE_PIN1);
 	}
 	else
 	{
-		digitalWrite(driver->pin1, LOW);
-		digitalWrite(driver->pin2, HIGH);
+		toggle_driver_write(1 << TOGGLE_PIN2);
 	}
 }
 
 void toggle_driver_stop(toggle_driver_t *driver)
 {
-	digitalWrite(driver->pin1, LOW);
-	digitalWrite(driver->pin2, LOW);
+	driver->dir = 0;
+
+	toggle_driver_write(0);
 }
@@ -11,13 +11,16 @@ extern "C"
 #define UP 0x01
 #define DOWN 0x02
 
+/**
+ * The control lines of the toggle driver are defined at compile time
+ * in pins.h.
+ */
 typedef struct
 {
-	uint8_t pin1;
-	uint8_t pin2;
+	uint8_t dir; /**< the direction the driver is moving in or 0 if stopped */
 } toggle_driver_t;
 
-void toggle_driver_init(toggle_driver_t *driver, uint8_t pin1, uint8_t pin2);
+void toggle_driver_init(toggle_driver_t *driver);
 void toggle_driver_move(toggle_driver_t *driver, uint8_t dir);
 void toggle_driver_stop(toggle_driver_t *driver);
 